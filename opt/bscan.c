@@ -0,0 +1,184 @@
+/* Benchmark for converting sweeps to RGBA
+ *
+ * Colors every sweep in a volume with the per gate conversion and colormap
+ * lookup that _bscan_sweep used to do, and with the 256 entry table using
+ * each version of colormap_lookup, then checks that they all produce the
+ * same pixels. The vector versions are also checked against the scalar one
+ * on random codes of every length up to a few vectors. Without a volume only
+ * that check is run, for make check. Exits non-zero if anything differs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "../src/wsr88d.c"
+#include "../src/wsr88d-decode.c"
+#include "../src/plugins/radar-info.c"
+
+/* The old loop, converting and looking up every gate */
+static void bscan_gates(Wsr88dSweep *sweep, AWeatherColormap *colormap,
+		guint8 *buf)
+{
+	for (guint ri = 0; ri < sweep->nrays; ri++) {
+		guint8 *ray = &sweep->data[ri*sweep->ngates];
+		for (guint bi = 0; bi < sweep->ngates; bi++) {
+			guint  buf_i = (ri*sweep->ngates+bi)*4;
+			if (ray[bi] == WSR88D_BELOW_THRESHOLD ||
+			    ray[bi] == WSR88D_RANGE_FOLDED) {
+				buf[buf_i+0] = 0x00;
+				buf[buf_i+1] = 0x00;
+				buf[buf_i+2] = 0x00;
+				buf[buf_i+3] = 0x00;
+				continue;
+			}
+			float   value = wsr88d_sweep_value(sweep, ray[bi]);
+			guint8 *data  = colormap_get(colormap, value);
+			buf[buf_i+0] = data[0];
+			buf[buf_i+1] = data[1];
+			buf[buf_i+2] = data[2];
+			buf[buf_i+3] = data[3]*0.75;
+		}
+	}
+}
+
+typedef void (*LookupFunc)(const guint32 *lut, const guint8 *codes,
+		guint32 *rgba, gsize n);
+
+static struct {
+	const gchar *name;
+	LookupFunc   func;
+	gboolean     have;
+	gdouble      time;
+	guint        wrong;
+} kernels[] = {
+	{"scalar", _colormap_lookup_scalar},
+#ifdef COLORMAP_X86
+	{"sse2",   _colormap_lookup_sse2},
+	{"avx2",   _colormap_lookup_avx2},
+#endif
+	{"auto",   colormap_lookup},
+};
+
+/* Random codes with runs of zeros, checking every alignment of the tail */
+static void check_kernels(void)
+{
+	guint32 lut[256];
+	guint8  codes[100];
+	guint32 want[100], got[100];
+	for (int i = 0; i < 256; i++)
+		lut[i] = g_random_int();
+	for (gsize n = 0; n <= sizeof(codes); n++) {
+		for (gsize i = 0; i < n; i++)
+			codes[i] = g_random_int_range(0, 4) ? 0 : g_random_int();
+		_colormap_lookup_scalar(lut, codes, want, n);
+		for (int k = 0; k < G_N_ELEMENTS(kernels); k++) {
+			if (!kernels[k].have)
+				continue;
+			memset(got, 0xa5, sizeof(got));
+			kernels[k].func(lut, codes, got, n);
+			if (memcmp(want, got, n*4) || (n < 100 && got[n] != 0xa5a5a5a5))
+				kernels[k].wrong++;
+		}
+	}
+}
+
+/* Print the results, returns the number of kernels that differ */
+static int print_kernels(guint total)
+{
+	int failed = 0;
+	for (int k = 0; k < G_N_ELEMENTS(kernels); k++) {
+		if (!kernels[k].have)
+			g_print("%-6s  unsupported\n", kernels[k].name);
+		else if (total)
+			g_print("%-6s  %7.2f ms (%.2f ns/gate), %u differ\n",
+					kernels[k].name, kernels[k].time*1000,
+					kernels[k].time*1e9/total, kernels[k].wrong);
+		else
+			g_print("%-6s  %u differ\n",
+					kernels[k].name, kernels[k].wrong);
+		if (kernels[k].wrong)
+			failed++;
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	g_thread_init(NULL);
+
+	for (int k = 0; k < G_N_ELEMENTS(kernels); k++)
+		kernels[k].have = TRUE;
+#ifdef COLORMAP_X86
+	kernels[1].have = __builtin_cpu_supports("sse2");
+	kernels[2].have = __builtin_cpu_supports("avx2");
+#endif
+	check_kernels();
+
+	if (argc < 2) {
+		g_print("usage: %s [level2-data [iterations]]\n", argv[0]);
+		return print_kernels(0) ? 1 : 0;
+	}
+	int iters = argc > 2 ? atoi(argv[2]) : 5;
+
+	gsize  len, raw_len;
+	gchar *input;
+	if (!g_file_get_contents(argv[1], &input, &len, NULL))
+		g_error("error reading %s", argv[1]);
+	gchar *raw = wsr88d_decompress(input, len, 0, &raw_len);
+	Wsr88dVolume *volume = raw ? wsr88d_volume_decode(raw, raw_len) : NULL;
+	if (!volume)
+		g_error("error decoding %s", argv[1]);
+
+	for (int i = 0; colormaps[i].file; i++) {
+		gchar *file = g_build_filename("../data/colors",
+				colormaps[i].file, NULL);
+		colormap_load(file, &colormaps[i]);
+		g_free(file);
+	}
+
+	gdouble gates_time = 0;
+	guint   total = 0;
+	GTimer *timer = g_timer_new();
+	for (guint si = 0; si < volume->nsweeps; si++) {
+		Wsr88dSweep *sweep = volume->sweeps[si];
+		AWeatherColormap *colormap = &colormaps[0];
+		for (int i = 0; colormaps[i].file; i++)
+			if (colormaps[i].type == sweep->moment)
+				colormap = &colormaps[i];
+
+		guint   size = sweep->nrays * sweep->ngates * 4;
+		guint8 *a    = g_malloc(size);
+		guint8 *b    = g_malloc(size);
+		g_timer_start(timer);
+		for (int n = 0; n < iters; n++)
+			bscan_gates(sweep, colormap, a);
+		gates_time += g_timer_elapsed(timer, NULL) / iters;
+		guint32 lut[256];
+		colormap_sweep_lut(colormap, sweep, lut);
+		for (int k = 0; k < G_N_ELEMENTS(kernels); k++) {
+			if (!kernels[k].have)
+				continue;
+			memset(b, 0, size);
+			g_timer_start(timer);
+			for (int n = 0; n < iters; n++)
+				kernels[k].func(lut, sweep->data, (guint32*)b,
+						sweep->nrays * sweep->ngates);
+			kernels[k].time += g_timer_elapsed(timer, NULL) / iters;
+			if (memcmp(a, b, size))
+				kernels[k].wrong++;
+		}
+		total += sweep->nrays * sweep->ngates;
+		g_free(a);
+		g_free(b);
+	}
+
+	g_print("%s: %u sweeps, %u gates\n", argv[1], volume->nsweeps, total);
+	g_print("gates:  %7.2f ms (%.2f ns/gate)\n",
+			gates_time*1000, gates_time*1e9/total);
+	int failed = print_kernels(total);
+
+	wsr88d_volume_free(volume);
+	g_free(raw);
+	g_free(input);
+	return failed ? 1 : 0;
+}
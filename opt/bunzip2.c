@@ -0,0 +1,128 @@
+/* Microbenchmark for the bzip2 record decompression used by wsr88ddec
+ *
+ * Compares the old doubling g_realloc loop (starting at 512 bytes) against
+ * the arena used by wsr88d.c and prints the allocations and copies needed
+ * for each volume, with one thread and with the default thread count (one
+ * per processor) or the count given on the command line. */
+
+#include <stdlib.h>
+#include <glib.h>
+#include <bzlib.h>
+#include "../src/wsr88d.c"
+
+/* Old bunzip2, instrumented */
+static char *bunzip2_old(const char *input, int input_len, int *output_len,
+		guint *allocs, gsize *copied)
+{
+	bz_stream *stream = g_new0(bz_stream, 1);
+	BZ2_bzDecompressInit(stream, 0, 0);
+
+	int   status;
+	int   output_size = 512;
+	char *output      = NULL;
+
+	do {
+		stream->next_in   = (char*)input + stream->total_in_lo32;
+		stream->avail_in  = input_len    - stream->total_in_lo32;
+		output_size *= 2;
+		output       = g_realloc(output, output_size);
+		*allocs     += 1;
+		*copied     += stream->total_out_lo32;
+		stream->next_out  = output      + stream->total_out_lo32;
+		stream->avail_out = output_size - stream->total_out_lo32;
+	} while ((status = BZ2_bzDecompress(stream)) == BZ_OK && output_size < SANITY_MAX_SIZE);
+
+	*output_len = stream->total_out_lo32;
+	BZ2_bzDecompressEnd(stream);
+	g_free(stream);
+	return output;
+}
+
+static gboolean count_cb(const gchar *data, gsize len, gpointer _total)
+{
+	*(gsize*)_total += len;
+	return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		g_print("usage: %s <level2-data> [iterations] [threads]\n", argv[0]);
+		return 0;
+	}
+	int iters   = argc > 2 ? atoi(argv[2]) : 10;
+	int threads = argc > 3 ? atoi(argv[3]) : 0;
+
+	g_thread_init(NULL);
+
+	gsize  len;
+	gchar *input;
+	if (!g_file_get_contents(argv[1], &input, &len, NULL))
+		g_error("error reading %s", argv[1]);
+	GArray *records = _scan_records(input, len);
+	if (!records)
+		g_error("error scanning %s", argv[1]);
+
+	/* Old */
+	guint  old_allocs = 0;
+	gsize  old_copied = 0;
+	gsize  old_total  = 0;
+	GTimer *timer = g_timer_new();
+	for (int n = 0; n < iters; n++) {
+		for (guint i = 0; i < records->len; i++) {
+			Record *record = &g_array_index(records, Record, i);
+			int   dec_len;
+			char *dec = bunzip2_old(record->input, record->input_len,
+					&dec_len, &old_allocs, &old_copied);
+			old_total += dec_len;
+			g_free(dec);
+		}
+	}
+	gdouble old_time = g_timer_elapsed(timer, NULL);
+
+	g_print("%s: %u records, %.2f MB per volume\n", argv[1], records->len,
+			(double)old_total/iters/1000000);
+	g_print("  %-14s %10s %12s %10s\n", "", "allocs/vol", "MB copied/vol", "ms/vol");
+	g_print("  %-14s %10.1f %12.2f %10.1f\n", "realloc",
+			(double)old_allocs/iters, (double)old_copied/iters/1000000,
+			old_time*1000/iters);
+
+	/* New, callback and in-memory versions */
+	gint counts[] = {1, _get_threads(threads)};
+	for (int t = 0; t < G_N_ELEMENTS(counts); t++) {
+		gsize new_total = 0;
+		Wsr88dStats cb_stats, mem_stats;
+		wsr88d_reset_stats();
+		g_timer_start(timer);
+		for (int n = 0; n < iters; n++)
+			wsr88d_decompress_cb(input, len, counts[t], count_cb, &new_total);
+		gdouble cb_time = g_timer_elapsed(timer, NULL);
+		wsr88d_get_stats(&cb_stats);
+
+		wsr88d_reset_stats();
+		g_timer_start(timer);
+		for (int n = 0; n < iters; n++) {
+			gsize  out_len;
+			gchar *out = wsr88d_decompress(input, len, counts[t], &out_len);
+			g_free(out);
+		}
+		gdouble mem_time = g_timer_elapsed(timer, NULL);
+		wsr88d_get_stats(&mem_stats);
+
+		gchar *cb_name  = g_strdup_printf("arena-cb -j%d",  counts[t]);
+		gchar *mem_name = g_strdup_printf("arena-mem -j%d", counts[t]);
+		g_print("  %-14s %10.1f %12.2f %10.1f\n", cb_name,
+				(double)cb_stats.allocs/iters, (double)cb_stats.copied/iters/1000000,
+				cb_time*1000/iters);
+		g_print("  %-14s %10.1f %12.2f %10.1f\n", mem_name,
+				(double)mem_stats.allocs/iters, (double)mem_stats.copied/iters/1000000,
+				mem_time*1000/iters);
+		g_free(cb_name);
+		g_free(mem_name);
+	}
+
+	g_timer_destroy(timer);
+	g_array_free(records, TRUE);
+	g_free(input);
+	return 0;
+}
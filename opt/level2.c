@@ -1,128 +1,319 @@
-/* Prototype stuff for parsing Level-II data */
-/*
- * TODO: ARGG, the packet sizses are all wrong..
- *       Check sizes of decompressed bzip files
- *       Split things back up to seperate files
- * The second bzip contains different size packets?
- */
-
-#include <stdio.h>
+/* Benchmark for the native Level II decoder against RSL
+ *
+ * Decodes the same decompressed volume with RSL_wsr88d_to_radar and with
+ * wsr88d_volume_decode, then reads back every reflectivity gate from each
+ * and compares the lowest reflectivity sweep gate by gate. RSL is only used
+ * when built with HAVE_RSL, otherwise just the native decoder is timed. */
+
 #include <stdlib.h>
-#include <errno.h>
-#include <error.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <glib.h>
-#include <bzlib.h>
-#include "level2.h"
+#include <glib/gstdio.h>
+#ifdef HAVE_RSL
+#include <rsl.h>
+#endif
+#include "../src/wsr88d.c"
+#include "../src/wsr88d-decode.c"
 
-/* Not used in favor of RSL */
-level2_packet_t **level2_split_packets(char *data, int *num_packets, int data_size)
+static gsize native_size(Wsr88dVolume *volume)
 {
-	int packet_i = 0;
-	level2_packet_t  *packet = (level2_packet_t *)data;
-	int max_packets = 128;
-	level2_packet_t **packets = malloc(sizeof(level2_packet_t *)*max_packets);
-	while ((void *)packet < (void *)(data+data_size)) {
-		/* Increase packets size if necessasairy */
-		if (packet_i >= max_packets) {
-			max_packets *= 2;
-			packets = realloc(packets, sizeof(level2_packet_t *)*max_packets);
-		}
+	gsize size = sizeof(Wsr88dVolume);
+	for (guint i = 0; i < volume->nsweeps; i++) {
+		Wsr88dSweep *sweep = volume->sweeps[i];
+		size += sizeof(Wsr88dSweep) + sweep->nrays*sizeof(Wsr88dRay) +
+			sweep->nrays*sweep->ngates;
+	}
+	return size;
+}
 
-		/* Fix byte order for packet */
-		packet->size = g_ntohs(packet->size);
-		packet->seq  = g_ntohs(packet->seq);
-		// TODO: Convert the rest of the bytes
+/* Resident memory from /proc/self/status, in bytes */
+static gsize proc_status(const gchar *field)
+{
+	gchar *status = NULL;
+	gsize  kb     = 0;
+	if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+		gchar *line = strstr(status, field);
+		if (line)
+			kb = strtoul(line + strlen(field), NULL, 10);
+	}
+	g_free(status);
+	return kb * 1024;
+}
 
-		/* Save packet location */
-		packets[packet_i] = packet;
+static gboolean push_record(const gchar *data, gsize len, gpointer volume)
+{
+	return wsr88d_volume_push(volume, data, len);
+}
 
-		/* Increment packet and packet_i */
-		// new =                      old              + CTM + 2*size         + fcs
-		//packet = (level2_packet_t *)( ((char *)packet) + 12  + 2*packet->size + 4 );
-		packet++;
-		packet_i++;
+/* Peak memory used while decoding every sweep of a volume that was pushed
+ * one record at a time, the way it is while downloading. Runs in a child
+ * so each order starts from the same heap. by_moment decodes the sweeps in
+ * table order, one moment at a time, instead of with load_all. */
+static gsize load_peak(const gchar *input, gsize len, gboolean by_moment)
+{
+	int fds[2];
+	gsize peak = 0;
+	if (pipe(fds) != 0)
+		return 0;
+	pid_t pid = fork();
+	if (pid == 0) {
+		Wsr88dVolume *volume = wsr88d_volume_new();
+		wsr88d_decompress_cb(input, len, 1, push_record, volume);
+		wsr88d_volume_finish(volume);
+		/* Reset the peak, it needs Linux 4.0 */
+		g_file_set_contents("/proc/self/clear_refs", "5", 1, NULL);
+		gsize start = proc_status("VmRSS:");
+		if (by_moment)
+			for (guint i = 0; i < volume->nsweeps; i++)
+				wsr88d_volume_load_sweep(volume, volume->sweeps[i]);
+		else
+			wsr88d_volume_load_all(volume);
+		peak = proc_status("VmHWM:") - start;
+		if (write(fds[1], &peak, sizeof(peak)) != sizeof(peak))
+			_exit(1);
+		_exit(0);
 	}
-	packets = realloc(packets, sizeof(level2_packet_t *)*packet_i);
-	*num_packets = packet_i;
-	return packets;
+	close(fds[1]);
+	if (pid < 0 || read(fds[0], &peak, sizeof(peak)) != sizeof(peak))
+		peak = 0;
+	close(fds[0]);
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+	return peak;
 }
 
-/* Not used in favor of RSL */
-level2_packet_t *level2_decompress(char *raw_data, int *num_packets)
+/* Sum every reflectivity gate, the way _bscan_sweep reads them */
+static gdouble native_read(Wsr88dVolume *volume, guint *gates)
 {
-	/* Read header */
-	FILE *fd = fopen(raw_data, "r");
-	if (fd == NULL)
-		error(1, errno, "Error opening files `%s'", raw_data);
-	level2_header_t header;
-	if (1 != fread(&header, sizeof(level2_header_t), 1, fd))
-		error(1, errno, "Error reading header");
-
-	/* Decompress the bzips
-	 *   store the entire sequence starting at data
-	 *   cur_data is for each individual bzip and is the last chunk of data */
-	char *data = NULL;
-	int data_size = 0; // size of previously decmpressed data
-	char *bz2 = NULL;  // temp buf for bzipped data
-	unsigned int _bz2_size = 0;
-	while ((int)_bz2_size >= 0) {
-		if (1 != fread(&_bz2_size, 4, 1, fd))
-			break; //error(1, errno, "Error reading _bz2_size, pos=%x", (unsigned int)ftell(fd));
-		_bz2_size = g_ntohl(_bz2_size);
-		int bz2_size = abs(_bz2_size);
-
-		/* Read data */
-		if (NULL == (bz2 = (char *)realloc(bz2, bz2_size)))
-			error(1, errno, "cannot allocate `%d' bytes for buffer", bz2_size);
-		if (bz2_size != fread(bz2, 1, bz2_size, fd))
-			error(1, errno, "error reading from input file");
-
-		/* Decompress on individual bzip to the end of the sequence */
-		unsigned int cur_data_size = 1<<17;
-		int status = BZ_OUTBUFF_FULL;
-		while (status == BZ_OUTBUFF_FULL) {
-			cur_data_size *= 2;
-			data = realloc(data, data_size + cur_data_size);
-			status = BZ2_bzBuffToBuffDecompress(data + data_size, &cur_data_size, bz2, bz2_size, 0, 0);
+	gdouble sum = 0;
+	for (guint si = 0; si < volume->nsweeps; si++) {
+		Wsr88dSweep *sweep = volume->sweeps[si];
+		if (sweep->moment != WSR88D_REF)
+			continue;
+		guint8 *data = sweep->data;
+		for (guint i = 0; i < sweep->nrays*sweep->ngates; i++) {
+			if (data[i] > WSR88D_RANGE_FOLDED) {
+				sum += wsr88d_sweep_value(sweep, data[i]);
+				*gates += 1;
+			}
 		}
-		if (status != BZ_OK)
-			error(1, 1, "Error decompressing data");
-		data_size += cur_data_size; // Add current chunk to decompressed data
-
-		/* Debug */
-		printf("data_size = %d, cur_data_size = %d\n", data_size, cur_data_size);
 	}
-	data = realloc(data, data_size); // free unused space at the end
+	return sum;
+}
 
-	return (level2_packet_t *)data;
-	//return level2_split_packets(data, num_packets, data_size);
+#ifdef HAVE_RSL
+/* Rough heap usage of an RSL radar, ignoring the volume headers */
+static gsize rsl_size(Radar *radar)
+{
+	gsize size = sizeof(Radar);
+	for (int vi = 0; vi < radar->h.nvolumes; vi++) {
+		Volume *vol = radar->v[vi];
+		if (!vol) continue;
+		size += sizeof(Volume) + vol->h.nsweeps*sizeof(Sweep*);
+		for (int si = 0; si < vol->h.nsweeps; si++) {
+			Sweep *sweep = vol->sweep[si];
+			if (!sweep) continue;
+			size += sizeof(Sweep) + sweep->h.nrays*sizeof(Ray*);
+			for (int ri = 0; ri < sweep->h.nrays; ri++)
+				if (sweep->ray[ri])
+					size += sizeof(Ray) +
+						sweep->ray[ri]->h.nbins*sizeof(Range);
+		}
+	}
+	return size;
 }
 
+static gdouble rsl_read(Radar *radar, guint *gates)
+{
+	gdouble sum = 0;
+	Volume *vol = RSL_get_volume(radar, DZ_INDEX);
+	for (int si = 0; vol && si < vol->h.nsweeps; si++) {
+		Sweep *sweep = vol->sweep[si];
+		for (int ri = 0; sweep && ri < sweep->h.nrays; ri++) {
+			Ray *ray = sweep->ray[ri];
+			for (int bi = 0; ray && bi < ray->h.nbins; bi++) {
+				float value = ray->h.f(ray->range[bi]);
+				if (value < BADVAL-10) {
+					sum += value;
+					*gates += 1;
+				}
+			}
+		}
+	}
+	return sum;
+}
 
+/* Compare the lowest reflectivity sweep, ray by ray */
+static void compare(Radar *radar, Wsr88dVolume *volume)
+{
+	Volume      *vol   = RSL_get_volume(radar, DZ_INDEX);
+	Sweep       *rsl   = vol ? RSL_get_closest_sweep(vol, 0, 90) : NULL;
+	Wsr88dSweep *sweep = wsr88d_volume_get_sweep(volume, WSR88D_REF, 0);
+	if (!rsl || !sweep) {
+		g_print("compare: missing reflectivity\n");
+		return;
+	}
+	guint checked = 0, wrong = 0;
+	for (int ri = 0; ri < rsl->h.nrays && ri < sweep->nrays; ri++) {
+		Ray    *ray  = rsl->ray[ri];
+		guint8 *data = &sweep->data[ri*sweep->ngates];
+		if (!ray || fabs(ray->h.azimuth - sweep->rays[ri].azimuth) > 0.1) {
+			wrong++;
+			continue;
+		}
+		for (int bi = 0; bi < ray->h.nbins && bi < sweep->ngates; bi++) {
+			float a = ray->h.f(ray->range[bi]);
+			float b = data[bi] > WSR88D_RANGE_FOLDED ?
+				wsr88d_sweep_value(sweep, data[bi]) : BADVAL;
+			gboolean abad = a >= BADVAL-10, bbad = b >= BADVAL-10;
+			if (abad != bbad || (!abad && fabs(a-b) > 0.5))
+				wrong++;
+			checked++;
+		}
+	}
+	g_print("compare: %.2f° %d rays, %u gates checked, %u differ\n",
+			sweep->elev, rsl->h.nrays, checked, wrong);
+}
+#endif
 
 int main(int argc, char **argv)
 {
 	if (argc < 2) {
-		printf("usage: %s <level2-data>\n", argv[0]);
+		g_print("usage: %s <level2-data> [iterations]\n", argv[0]);
 		return 0;
 	}
+	int iters = argc > 2 ? atoi(argv[2]) : 5;
+
+	g_thread_init(NULL);
+
+	/* Decompress once, only the decoding is timed */
+	gsize  len, raw_len;
+	gchar *input;
+	if (!g_file_get_contents(argv[1], &input, &len, NULL))
+		g_error("error reading %s", argv[1]);
+	gchar *raw = wsr88d_decompress(input, len, 0, &raw_len);
+	if (!raw)
+		g_error("error decompressing %s", argv[1]);
+	gchar *raw_file = g_strdup_printf("%s/level2-%d.raw",
+			g_get_tmp_dir(), getpid());
+	if (!g_file_set_contents(raw_file, raw, raw_len, NULL))
+		g_error("error writing %s", raw_file);
+
+	/* Peak memory, before anything else grows the heap */
+	gsize peak_moment = load_peak(input, len, TRUE);
+	gsize peak_record = load_peak(input, len, FALSE);
+
+	GTimer *timer = g_timer_new();
+
+#ifdef HAVE_RSL
+	/* RSL */
+	Radar  *radar = NULL;
+	RSL_read_these_sweeps("all", NULL);
+	for (int n = 0; n < iters; n++) {
+		if (radar)
+			RSL_free_radar(radar);
+		radar = RSL_wsr88d_to_radar(raw_file, "");
+		if (!radar)
+			g_error("RSL failed to read %s", raw_file);
+		RSL_sort_radar(radar);
+	}
+	gdouble rsl_time = g_timer_elapsed(timer, NULL) / iters;
+	guint   rsl_gates = 0;
+	g_timer_start(timer);
+	gdouble rsl_sum  = rsl_read(radar, &rsl_gates);
+	gdouble rsl_scan = g_timer_elapsed(timer, NULL);
+#endif
 
-	int num_packets;
-	level2_packet_t *packets = level2_decompress(argv[1], &num_packets);
-	printf("read %d packets\n", num_packets);
-	
-	//FILE *output = fopen("output.dat", "w+");
-	//fwrite(packets[i], 1, 18470816, output);
-	//fclose(output);
-
-	FILE *output = fopen("output.dat", "w+");
-	int i;
-	for (i = 0; i < 10000; i++) {
-		printf("packet: size=%x, seq=%d\n", g_ntohs(packets[i].size), g_ntohs(packets[i].seq));
-		fwrite("################", 1, 16, output);
-		fwrite(packets+i, 1, sizeof(level2_packet_t), output);
+	/* Native */
+	Wsr88dVolume *volume = NULL;
+	g_timer_start(timer);
+	for (int n = 0; n < iters; n++) {
+		if (volume)
+			wsr88d_volume_free(volume);
+		volume = wsr88d_volume_decode(raw, raw_len);
+		if (!volume)
+			g_error("failed to decode %s", argv[1]);
 	}
-	fclose(output);
+	gdouble native_time = g_timer_elapsed(timer, NULL) / iters;
+	guint   native_gates = 0;
+	g_timer_start(timer);
+	gdouble native_sum  = native_read(volume, &native_gates);
+	gdouble native_scan = g_timer_elapsed(timer, NULL);
+
+	/* Native, indexing only and loading the lowest reflectivity sweep,
+	 * which is all that is needed before the first draw */
+	gdouble native_first = 0;
+	for (int n = 0; n < iters; n++) {
+		g_timer_start(timer);
+		Wsr88dVolume *lazy = wsr88d_volume_new();
+		wsr88d_volume_push(lazy, raw, raw_len);
+		wsr88d_volume_finish(lazy);
+		wsr88d_volume_load_sweep(lazy,
+				wsr88d_volume_get_sweep(lazy, WSR88D_REF, 0));
+		native_first += g_timer_elapsed(timer, NULL) / iters;
+		wsr88d_volume_free(lazy);
+	}
+
+	/* Cache, saving the decoded volume and mapping it again */
+	gchar *cache_file = g_strdup_printf("%s/level2-%d.vol",
+			g_get_tmp_dir(), getpid());
+	g_timer_start(timer);
+	if (!wsr88d_volume_save(volume, cache_file))
+		g_error("error writing %s", cache_file);
+	gdouble cache_save = g_timer_elapsed(timer, NULL);
+	struct stat cache_stat;
+	if (g_stat(cache_file, &cache_stat) != 0)
+		g_error("error reading %s", cache_file);
+	gdouble cache_map  = 0;
+	for (int n = 0; n < iters; n++) {
+		g_timer_start(timer);
+		Wsr88dVolume *mapped = wsr88d_volume_map(cache_file);
+		wsr88d_volume_load_all(mapped);
+		guint gates = 0;
+		native_read(mapped, &gates);
+		cache_map += g_timer_elapsed(timer, NULL) / iters;
+		/* Also keeps the unused sum from being optimized out */
+		if (gates != native_gates)
+			g_error("cache read %u gates, expected %u",
+					gates, native_gates);
+		wsr88d_volume_free(mapped);
+	}
+
+	/* Results */
+	g_print("%s: %.1f MB decompressed, %u sweeps\n", argv[1],
+			(gdouble)raw_len/1e6, volume->nsweeps);
+#ifdef HAVE_RSL
+	g_print("rsl:    decode %7.1f ms, read refl %6.1f ms, %6.1f MB, "
+			"%u gates (mean %.2f dBZ)\n",
+			rsl_time*1000, rsl_scan*1000, (gdouble)rsl_size(radar)/1e6,
+			rsl_gates, rsl_sum/MAX(rsl_gates,1));
+#endif
+	g_print("native: decode %7.1f ms, read refl %6.1f ms, %6.1f MB, "
+			"%u gates (mean %.2f dBZ)\n",
+			native_time*1000, native_scan*1000, (gdouble)native_size(volume)/1e6,
+			native_gates, native_sum/MAX(native_gates,1));
+	g_print("lazy:   first sweep %7.1f ms\n", native_first*1000);
+	g_print("load:   peak RSS %6.1f MB by moment, %6.1f MB by record\n",
+			(gdouble)peak_moment/1e6, (gdouble)peak_record/1e6);
+	g_print("cache:  save %7.1f ms, map and read refl %6.1f ms, "
+			"%.1f MB (%.1f MB bzip2)\n",
+			cache_save*1000, cache_map*1000,
+			(gdouble)cache_stat.st_size/1e6, (gdouble)len/1e6);
+#ifdef HAVE_RSL
+	compare(radar, volume);
+	RSL_free_radar(radar);
+#endif
 
+	g_remove(raw_file);
+	g_remove(cache_file);
+	g_free(cache_file);
+	wsr88d_volume_free(volume);
+	g_free(raw_file);
+	g_free(raw);
+	g_free(input);
 	return 0;
 }
@@ -0,0 +1,175 @@
+/* Check for the palette shader
+ *
+ * Renders gate codes through radar_gl_palette_program with a palette from
+ * radar_gl_load_palette, the way level2 draws sweeps, and compares every
+ * pixel with colormap_lookup for each colormap. The context comes from EGL
+ * without a display, so it runs on Mesa's llvmpipe on machines without a
+ * GPU. Exits 77 (skipped) when no OpenGL 2.0 context can be made, and
+ * non-zero if anything differs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "../src/plugins/radar-gl.c"
+#include "../src/plugins/radar-info.c"
+
+#ifndef COLORS_DIR
+#define COLORS_DIR "../data/colors"
+#endif
+
+#define WIDTH  256
+#define HEIGHT 64
+
+/* Scale and offset of each moment in the Level II format */
+static const struct {
+	Wsr88dMoment moment;
+	gfloat       scale;
+	gfloat       offset;
+} moments[] = {
+	{WSR88D_REF,   2.0,    66.0},
+	{WSR88D_VEL,   2.0,   129.0},
+	{WSR88D_SW,    2.0,   129.0},
+	{WSR88D_ZDR,  16.0,   128.0},
+	{WSR88D_PHI,   2.8361,  2.0},
+	{WSR88D_RHO, 300.0,   -60.0},
+};
+
+static gboolean make_context(void)
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_display =
+		(void*)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_display)
+		display = get_display(EGL_PLATFORM_SURFACELESS_MESA,
+				EGL_DEFAULT_DISPLAY, NULL);
+#endif
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (!eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API))
+		return FALSE;
+
+	EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE,   8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE,  8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE,
+	};
+	EGLint surface_attribs[] = {
+		EGL_WIDTH,  WIDTH,
+		EGL_HEIGHT, HEIGHT,
+		EGL_NONE,
+	};
+	EGLConfig config;
+	EGLint    nconfigs = 0;
+	if (!eglChooseConfig(display, config_attribs, &config, 1, &nconfigs) ||
+	    nconfigs < 1)
+		return FALSE;
+	EGLSurface surface = eglCreatePbufferSurface(display, config,
+			surface_attribs);
+	EGLContext context = eglCreateContext(display, config,
+			EGL_NO_CONTEXT, NULL);
+	if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT)
+		return FALSE;
+	return eglMakeCurrent(display, surface, surface, context);
+}
+
+/* Draw the codes over the whole surface, one pixel per gate */
+static void draw_codes(GLuint program, GLuint codes, GLuint palette)
+{
+	glViewport(0, 0, WIDTH, HEIGHT);
+	glMatrixMode(GL_PROJECTION); glLoadIdentity();
+	glOrtho(0, WIDTH, 0, HEIGHT, -1, 1);
+	glMatrixMode(GL_MODELVIEW);  glLoadIdentity();
+	glDisable(GL_BLEND);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	radar_gl.UseProgram(program);
+	radar_gl.ActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_1D, palette);
+	radar_gl.ActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, codes);
+	glColor4f(1,1,1,1);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0, 0); glVertex2f(0,     0);
+	glTexCoord2f(1, 0); glVertex2f(WIDTH, 0);
+	glTexCoord2f(1, 1); glVertex2f(WIDTH, HEIGHT);
+	glTexCoord2f(0, 1); glVertex2f(0,     HEIGHT);
+	glEnd();
+	radar_gl.UseProgram(0);
+}
+
+int main(int argc, char **argv)
+{
+	if (!make_context()) {
+		g_print("no EGL context, skipping\n");
+		return 77;
+	}
+	g_print("%s, OpenGL %s\n", glGetString(GL_RENDERER),
+			glGetString(GL_VERSION));
+	GLuint program = radar_gl_palette_program();
+	if (!program) {
+		g_print("no shaders, skipping\n");
+		return 77;
+	}
+
+	/* Every code in the first row, random ones after */
+	static guint8  codes[WIDTH*HEIGHT];
+	static guint32 want[WIDTH*HEIGHT], got[WIDTH*HEIGHT];
+	for (int i = 0; i < WIDTH*HEIGHT; i++)
+		codes[i] = i < 256 ? i : g_random_int_range(0, 256);
+
+	GLuint codes_tex = 0, palette_tex = 0;
+	glGenTextures(1, &codes_tex);
+	glBindTexture(GL_TEXTURE_2D, codes_tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8, WIDTH, HEIGHT, 0,
+			GL_LUMINANCE, GL_UNSIGNED_BYTE, codes);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	int failed = 0;
+	for (int i = 0; colormaps[i].file; i++) {
+		gchar *file = g_build_filename(COLORS_DIR, colormaps[i].file, NULL);
+		colormap_load(file, &colormaps[i]);
+		g_free(file);
+
+		Wsr88dSweep sweep = {.moment = colormaps[i].type};
+		for (int j = 0; j < G_N_ELEMENTS(moments); j++) {
+			if (moments[j].moment != sweep.moment)
+				continue;
+			sweep.scale  = moments[j].scale;
+			sweep.offset = moments[j].offset;
+		}
+
+		guint32 lut[256];
+		colormap_sweep_lut(&colormaps[i], &sweep, lut);
+		colormap_lookup(lut, codes, want, WIDTH*HEIGHT);
+		radar_gl_load_palette(&palette_tex, lut);
+		draw_codes(program, codes_tex, palette_tex);
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, got);
+
+		guint wrong = 0;
+		for (int k = 0; k < WIDTH*HEIGHT; k++) {
+			if (got[k] == want[k])
+				continue;
+			if (!wrong++)
+				g_print("%s: code %d is %08x, expected %08x\n",
+						colormaps[i].file, codes[k],
+						GUINT32_FROM_BE(got[k]),
+						GUINT32_FROM_BE(want[k]));
+		}
+		g_print("%-6s  %u differ\n", colormaps[i].file, wrong);
+		if (glGetError() != GL_NO_ERROR || wrong)
+			failed++;
+	}
+	return failed ? 1 : 0;
+}
@@ -16,200 +16,603 @@
  */
 
 #include <config.h>
+#include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib/gstdio.h>
 #include <grits.h>
-#include <rsl.h>
 
 #include "level2.h"
+#include "radar-gl.h"
+#include "../aweather-location.h"
+#include "../wsr88d.h"
 
 #define ISO_MIN 30
 #define ISO_MAX 80
+#define ISO_RES 2000   // Default isosurface grid spacing (m)
+#define ISO_TOP 20000  // Height of the isosurface grid (m)
+#define ISO_SHELLS 3   // Levels shown by set_iso_shells
+
+static const gfloat iso_shells[ISO_SHELLS] = {30, 45, 60};
 
 /**************************
  * Data loading functions *
  **************************/
+/* Rays are split into blocks for the worker threads, each thread writes
+ * its own rows of the buffer. Small sweeps are done in one block. */
+#define BSCAN_BLOCK (64*1024)
+
+typedef struct {
+	const guint32 *lut;
+	const guint8  *codes;
+	guint32       *rgba;
+	gsize          len;
+} BscanBlock;
+
+static void _bscan_block(gpointer _block, gpointer user_data)
+{
+	BscanBlock *block = _block;
+	colormap_lookup(block->lut, block->codes, block->rgba, block->len);
+}
+
+static gint _cpu_threads(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	return MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+#else
+	return 1;
+#endif
+}
+
 /* Convert a sweep to an 2d array of data points */
-static void _bscan_sweep(Sweep *sweep, AWeatherColormap *colormap,
+static void _bscan_sweep(Wsr88dSweep *sweep, AWeatherColormap *colormap,
 		guint8 **data, int *width, int *height)
 {
 	g_debug("AWeatherLevel2: _bscan_sweep - %p, %p, %p",
 			sweep, colormap, data);
-	/* Calculate max number of bins */
-	int max_bins = 0;
-	for (int i = 0; i < sweep->h.nrays; i++)
-		max_bins = MAX(max_bins, sweep->ray[i]->h.nbins);
-
-	/* Allocate buffer using max number of bins for each ray */
-	guint8 *buf = g_malloc0(sweep->h.nrays * max_bins * 4);
-
-	/* Fill the data */
-	for (int ri = 0; ri < sweep->h.nrays; ri++) {
-		Ray *ray  = sweep->ray[ri];
-		for (int bi = 0; bi < ray->h.nbins; bi++) {
-			guint  buf_i = (ri*max_bins+bi)*4;
-			float  value = ray->h.f(ray->range[bi]);
-
-			/* Check for bad values */
-			if (value == BADVAL     || value == RFVAL      || value == APFLAG ||
-			    value == NOTFOUND_H || value == NOTFOUND_V || value == NOECHO) {
-				buf[buf_i+3] = 0x00; // transparent
-				continue;
-			}
+	GTimer *timer = g_timer_new();
+	guint32 lut[256];
+	colormap_sweep_lut(colormap, sweep, lut);
 
-			/* Copy color to buffer */
-			guint8 *data = colormap_get(colormap, value);
-			buf[buf_i+0] = data[0];
-			buf[buf_i+1] = data[1];
-			buf[buf_i+2] = data[2];
-			buf[buf_i+3] = data[3]*0.75; // TESTING
-		}
+	/* One RGBA pixel for each gate, in blocks of whole rays */
+	guint    ngates  = sweep->nrays * sweep->ngates;
+	guint32 *buf     = g_malloc(ngates * 4);
+	guint    per     = MAX(BSCAN_BLOCK / MAX(sweep->ngates, 1), 1);
+	guint    nblocks = (sweep->nrays + per-1) / per;
+	gint     threads = MIN(_cpu_threads(), nblocks);
+	BscanBlock *blocks = g_new0(BscanBlock, nblocks);
+	for (guint b = 0; b < nblocks; b++) {
+		guint rays = MIN(per, sweep->nrays - b*per);
+		blocks[b].lut   = lut;
+		blocks[b].codes = sweep->data + b*per*sweep->ngates;
+		blocks[b].rgba  = buf         + b*per*sweep->ngates;
+		blocks[b].len   = rays*sweep->ngates;
 	}
+	if (threads <= 1) {
+		for (guint b = 0; b < nblocks; b++)
+			_bscan_block(&blocks[b], NULL);
+	} else {
+		GThreadPool *pool = g_thread_pool_new(_bscan_block, NULL,
+				threads, FALSE, NULL);
+		for (guint b = 0; b < nblocks; b++)
+			g_thread_pool_push(pool, &blocks[b], NULL);
+		g_thread_pool_free(pool, FALSE, TRUE);
+	}
+	g_free(blocks);
+	g_debug("AWeatherLevel2: _bscan_sweep - %dx%d in %.2f ms, %d threads",
+			sweep->nrays, sweep->ngates,
+			g_timer_elapsed(timer, NULL)*1000, MAX(threads, 1));
+	g_timer_destroy(timer);
 
 	/* set output */
-	*width  = max_bins;
-	*height = sweep->h.nrays;
-	*data   = buf;
-}
-
-/* Load a sweep into an OpenGL texture */
-static void _load_sweep_gl(AWeatherLevel2 *level2)
-{
-	g_debug("AWeatherLevel2: _load_sweep_gl");
-	guint8 *data;
-	gint width, height;
-	_bscan_sweep(level2->sweep, level2->sweep_colors, &data, &width, &height);
-	gint tex_width  = pow(2, ceil(log(width )/log(2)));
-	gint tex_height = pow(2, ceil(log(height)/log(2)));
-	level2->sweep_coords[0] = (double)width  / tex_width;
-	level2->sweep_coords[1] = (double)height / tex_height;
-
-	if (!level2->sweep_tex)
-		 glGenTextures(1, &level2->sweep_tex);
-	glBindTexture(GL_TEXTURE_2D, level2->sweep_tex);
+	*width  = sweep->ngates;
+	*height = sweep->nrays;
+	*data   = (guint8*)buf;
+}
+
+/* Sweeps are uploaded as their 8 bit gate codes and colored when they are
+ * drawn by radar_gl_palette_program. This is a quarter of the size of an
+ * RGBA texture and the codes can be uploaded straight from the volume.
+ * Without shaders the sweep is converted to RGBA with _bscan_sweep instead. */
+static GLuint sweep_program;
+static gint   sweep_program_state; // 0 not tried yet, 1 loaded, -1 unsupported
+
+/* Compile the palette shader the first time it's needed, this must be
+ * called with the GL context current. Returns 0 if shaders don't work.
+ * Workers read the state to decide whether to convert sweeps themselves,
+ * so it's only set once the outcome is known. */
+static GLuint _sweep_program(void)
+{
+	if (sweep_program_state)
+		return sweep_program;
+	sweep_program = radar_gl_palette_program();
+	g_atomic_int_set(&sweep_program_state, sweep_program ? 1 : -1);
+	return sweep_program;
+}
+
+/* The mesh for a sweep is a triangle strip along the near and far edges of
+ * the rays, with the texture coordinates and vertices of each point
+ * interleaved. It only depends on the sweep so it's built once, along with
+ * the texture, and kept in a vertex buffer when the driver has them. */
+#define MESH_STRIDE 5
+
+static void _load_mesh_gl(AWeatherLevel2 *level2, guint si,
+		gdouble xscale, gdouble yscale)
+{
+	Wsr88dSweep *sweep = level2->radar->sweeps[si];
+	gfloat *mesh = g_new(gfloat, (sweep->nrays+1)*2*MESH_STRIDE);
+	gfloat *point = mesh;
+	for (int ri = 0; ri <= sweep->nrays; ri++) {
+		Wsr88dRay *ray = NULL;
+		double angle = 0;
+		if (ri < sweep->nrays) {
+			ray = &sweep->rays[ri];
+			angle = deg2rad(ray->azimuth - ((double)sweep->beam_width/2.));
+		} else {
+			/* Do the right side of the last sweep */
+			ray = &sweep->rays[ri-1];
+			angle = deg2rad(ray->azimuth + ((double)sweep->beam_width/2.));
+		}
+
+		double lx = sin(angle);
+		double ly = cos(angle);
+
+		double near_dist = sweep->range_bin1 - ((double)sweep->gate_size/2.);
+		double far_dist  = near_dist + (double)sweep->ngates*sweep->gate_size;
+
+		/* (find middle of bin) / scale for opengl */
+		// near left
+		*point++ = 0.0;
+		*point++ = ((double)ri/sweep->nrays)*yscale;
+		*point++ = lx*near_dist;
+		*point++ = ly*near_dist;
+		*point++ = 2.0;
+
+		// far  left
+		// todo: correct range-height function
+		double height = sin(deg2rad(ray->elev)) * far_dist;
+		*point++ = xscale;
+		*point++ = ((double)ri/sweep->nrays)*yscale;
+		*point++ = lx*far_dist;
+		*point++ = ly*far_dist;
+		*point++ = height;
+	}
+
+	g_free(level2->sweep_meshes[si]);
+	level2->sweep_meshes[si] = mesh;
+#ifdef GL_VERSION_1_5
+	if (radar_gl_buffers()) {
+		if (!level2->sweep_vbos[si])
+			radar_gl.GenBuffers(1, &level2->sweep_vbos[si]);
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, level2->sweep_vbos[si]);
+		radar_gl.BufferData(GL_ARRAY_BUFFER, (point-mesh)*sizeof(gfloat),
+				mesh, GL_STATIC_DRAW);
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+#endif
+}
+
+/* Free the texture and mesh of a sweep, it's converted again if it's
+ * needed later. If it's the sweep being shown it's reloaded when drawn. */
+static void _free_sweep_gl(AWeatherLevel2 *level2, guint si)
+{
+	if (level2->sweep && level2->sweep_si == si && level2->sweep_texs[si])
+		level2->sweep_evicted = TRUE;
+	if (level2->sweep_texs[si])
+		glDeleteTextures(1, &level2->sweep_texs[si]);
+#ifdef GL_VERSION_1_5
+	if (level2->sweep_vbos[si])
+		radar_gl.DeleteBuffers(1, &level2->sweep_vbos[si]);
+#endif
+	g_free(level2->sweep_meshes[si]);
+	level2->sweep_texs[si]   = 0;
+	level2->sweep_vbos[si]   = 0;
+	level2->sweep_meshes[si] = NULL;
+}
+
+static void _evict_sweep_gl(gpointer _level2, guint si)
+{
+	AWeatherLevel2 *level2 = _level2;
+	level2->sweep_uses[si] = NULL;
+	_free_sweep_gl(level2, si);
+}
+
+/* Load a sweep into its own OpenGL texture, each sweep keeps its texture so
+ * switching back to it is only a bind. The data is either gate codes with
+ * GL_LUMINANCE or converted colors with GL_RGBA. It's uploaded from buffer
+ * when the worker already wrote it there, otherwise from data. */
+static void _load_sweep_gl(AWeatherLevel2 *level2, guint si, guint8 *data,
+		RadarTextureBuffer *buffer, GLenum format, gint width, gint height)
+{
+	g_debug("AWeatherLevel2: _load_sweep_gl - %u", si);
+
+	/* Codes can't be interpolated, only the colors */
+	GLenum internal = format == GL_LUMINANCE ? GL_LUMINANCE8 : GL_RGBA8;
+	GLenum filter   = format == GL_LUMINANCE ? GL_NEAREST    : GL_LINEAR;
+	gint   bpp      = format == GL_LUMINANCE ? 1             : 4;
+
+	gint tex_width, tex_height;
+	radar_texture_size(width, height, bpp, &tex_width, &tex_height);
+	_load_mesh_gl(level2, si, (double)width  / tex_width,
+	                          (double)height / tex_height);
+
+	if (!level2->sweep_texs[si])
+		 glGenTextures(1, &level2->sweep_texs[si]);
+	glBindTexture(GL_TEXTURE_2D, level2->sweep_texs[si]);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_width, tex_height, 0,
-			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0,0, width,height,
-			GL_RGBA, GL_UNSIGNED_BYTE, data);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal, tex_width, tex_height, 0,
+			format, GL_UNSIGNED_BYTE, NULL);
+	if (buffer)
+		radar_texture_upload_buffer(buffer, format, 0,0, width,height);
+	else
+		radar_texture_upload(format, 0,0, width,height, data);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	g_free(data);
-}
-
-/* Decompress a radar file using wsr88dec */
-static gboolean _decompress_radar(const gchar *file, const gchar *raw)
-{
-	g_debug("AWeatherLevel2: _decompress_radar - \n\t%s\n\t%s", file, raw);
-	char *argv[] = {"wsr88ddec", (gchar*)file, (gchar*)raw, NULL};
-	gint status;
-	GError *error = NULL;
-	g_spawn_sync(
-		NULL,    // const gchar *working_directory
-		argv,    // gchar **argv
-		NULL,    // gchar **envp
-		G_SPAWN_SEARCH_PATH, // GSpawnFlags flags
-		NULL,    // GSpawnChildSetupFunc child_setup
-		NULL,    // gpointer user_data
-		NULL,    // gchar *standard_output
-		NULL,    // gchar *standard_output
-		&status, // gint *exit_status
-		&error); // GError **error
-	if (error) {
-		g_warning("AWeatherLevel2: _decompress_radar - %s", error->message);
-		g_error_free(error);
-		return FALSE;
-	}
-	if (status != 0) {
-		gchar *msg = g_strdup_printf("wsr88ddec exited with status %d", status);
-		g_warning("AWeatherLevel2: _decompress_radar - %s", msg);
-		g_free(msg);
+	radar_texture_untrack(level2->sweep_uses[si]);
+	level2->sweep_uses[si] = radar_texture_track(
+			(gsize)tex_width*tex_height*bpp +
+			(level2->radar->sweeps[si]->nrays+1)*2*MESH_STRIDE*sizeof(gfloat),
+			_evict_sweep_gl, level2, si);
+}
+
+/* Colors for the gate codes of the sweep being shown. Only this needs to be
+ * rebuilt when the colormap changes. */
+static void _load_palette_gl(AWeatherLevel2 *level2)
+{
+	guint32 lut[256];
+	colormap_sweep_lut(level2->sweep_colors, level2->sweep, lut);
+	radar_gl_load_palette(&level2->sweep_pal, lut);
+}
+
+/* Decompress and decode a radar file while it is still downloading. Each
+ * record is decompressed as soon as it is complete and then passed on to
+ * the decoder, so only the last few records are left once it finishes. */
+struct _AWeatherLevel2Stream {
+	gchar        *site;
+	gchar        *file;    // Final path of the file being downloaded
+	gchar        *part;    // Path it is downloaded to, renamed to file at the end
+	FILE         *fp;
+	gboolean      broken;  // File was replaced, reload it at the end
+	Wsr88dStream *dec;
+	Wsr88dVolume *radar;
+	guint         shown;   // Sweeps in the last config from get_config
+	GTimer       *timer;   // Time since the stream was started
+	gint          pushed;  // Header and records passed to the decoder
+};
+
+static gboolean _stream_push_cb(const gchar *data, gsize len, gpointer _stream)
+{
+	AWeatherLevel2Stream *stream = _stream;
+	if (!wsr88d_volume_push(stream->radar, data, len))
 		return FALSE;
-	}
+	g_atomic_int_inc(&stream->pushed);
 	return TRUE;
 }
 
-/* Load the radar into a Grits Volume */
-static void _cart_to_sphere(VolCoord *out, VolCoord *in)
-{
-	gdouble angle = in->x;
-	gdouble dist  = in->y;
-	gdouble tilt  = in->z;
-	gdouble lx    = sin(angle);
-	gdouble ly    = cos(angle);
-	gdouble lz    = sin(tilt);
-	//out->x = (ly*dist)/20000;
-	//out->y = (lz*dist)/10000-0.5;
-	//out->z = (lx*dist)/20000-1.5;
-	out->x = (lx*dist);
-	out->y = (ly*dist);
-	out->z = (lz*dist);
-}
-
-static VolGrid *_load_grid(Volume *vol)
-{
-	g_debug("AWeatherLevel2: _load_grid");
-
-	Sweep *sweep   = vol->sweep[0];
-	Ray   *ray     = sweep->ray[0];
-	gint nsweeps   = vol->h.nsweeps;
-	gint nrays     = sweep->h.nrays/(1/sweep->h.beam_width)+1;
-	gint nbins     = ray->h.nbins  /(1000/ray->h.gate_size);
-	nbins = MIN(nbins, 150);
-
-	VolGrid  *grid = vol_grid_new(nrays, nbins, nsweeps);
-
-	gint rs, bs, val;
-	gint si=0, ri=0, bi=0;
-	for (si = 0; si < nsweeps; si++) {
-		sweep = vol->sweep[si];
-		rs    = 1.0/sweep->h.beam_width;
-	for (ri = 0; ri < nrays; ri++) {
-		/* TODO: missing rays, pick ri based on azmith */
-		ray   = sweep->ray[(ri*rs) % sweep->h.nrays];
-		bs    = 1000/ray->h.gate_size;
-	for (bi = 0; bi < nbins; bi++) {
-		if (bi*bs >= ray->h.nbins)
+/* Records decoded so far, not counting the volume header */
+static gint _stream_records(AWeatherLevel2Stream *stream)
+{
+	return MAX(g_atomic_int_get(&stream->pushed) - 1, 0);
+}
+
+static AWeatherLevel2Stream *_stream_new(const gchar *site)
+{
+	AWeatherLevel2Stream *stream = g_new0(AWeatherLevel2Stream, 1);
+	stream->site  = g_strdup(site);
+	stream->radar = wsr88d_volume_new();
+	stream->dec   = wsr88d_stream_new(0, _stream_push_cb, stream);
+	stream->timer = g_timer_new();
+	return stream;
+}
+
+/* Push whatever has been added to the file since the last read. While the
+ * file downloads, grits writes it to file.part and only renames it once it
+ * is complete, so read that when it exists. The rename keeps the inode, so
+ * the open file can still be read to the end after it has been renamed. */
+static void _stream_read(AWeatherLevel2Stream *stream, const gchar *file)
+{
+	if (stream->broken)
+		return;
+	if (stream->file && !g_str_equal(stream->file, file)) {
+		stream->broken = TRUE;
+		return;
+	}
+	if (!stream->fp) {
+		gchar *part = g_strconcat(file, ".part", NULL);
+		if ((stream->fp = g_fopen(part, "rb")))
+			stream->part = part;
+		else if ((stream->fp = g_fopen(file, "rb")))
+			g_free(part);
+		else {
+			g_free(part);
+			return;
+		}
+		stream->file = g_strdup(file);
+		g_debug("AWeatherLevel2: _stream_read - %.3fs, reading %s",
+				g_timer_elapsed(stream->timer, NULL),
+				stream->part ?: stream->file);
+	}
+
+	/* Make sure the file was not truncated or replaced */
+	struct stat fst, pst;
+	if (fstat(fileno(stream->fp), &fst) != 0 ||
+	    ((!stream->part || g_stat(stream->part, &pst) != 0) &&
+	     g_stat(file, &pst) != 0) ||
+	    fst.st_ino != pst.st_ino || fst.st_dev != pst.st_dev ||
+	    fst.st_size < ftell(stream->fp)) {
+		g_debug("AWeatherLevel2: _stream_read - file changed");
+		stream->broken = TRUE;
+		return;
+	}
+
+	gchar buf[64*1024];
+	gsize len, total = 0;
+	while ((len = fread(buf, 1, sizeof(buf), stream->fp)) > 0) {
+		total += len;
+		if (!wsr88d_stream_push(stream->dec, buf, len)) {
+			stream->broken = TRUE;
 			break;
-		val   = ray->h.f(ray->range[bi*bs]);
-		if (val == BADVAL     || val == RFVAL      ||
-		    val == APFLAG     || val == NOECHO     ||
-		    val == NOTFOUND_H || val == NOTFOUND_V ||
-		    val > 80)
-			val = 0;
-		VolPoint *point = vol_grid_get(grid, ri, bi, si);
-		point->value = val;
-		point->c.x = deg2rad(ray->h.azimuth);
-		point->c.y = bi*bs*ray->h.gate_size + ray->h.range_bin1;
-		point->c.z = deg2rad(ray->h.elev);
-	} } }
-
-	for (si = 0; si < nsweeps; si++)
-	for (ri = 0; ri < nrays; ri++)
-	for (bi = 0; bi < nbins; bi++) {
-		VolPoint *point = vol_grid_get(grid, ri, bi, si);
-		if (point->c.y == 0)
-			point->value = nan("");
-		else
-			_cart_to_sphere(&point->c, &point->c);
+		}
+	}
+	clearerr(stream->fp);
+	if (total)
+		g_debug("AWeatherLevel2: _stream_read - %.3fs, %ld bytes, "
+				"%d records decoded",
+				g_timer_elapsed(stream->timer, NULL),
+				ftell(stream->fp), _stream_records(stream));
+}
+
+/* Wait for the last records and decode the sweeps */
+static Wsr88dVolume *_stream_close(AWeatherLevel2Stream *stream)
+{
+	Wsr88dVolume *radar = stream->radar;
+	gboolean ok = wsr88d_stream_finish(stream->dec) && !stream->broken;
+	if (stream->fp)
+		fclose(stream->fp);
+	if (!ok || !wsr88d_volume_finish(radar)) {
+		wsr88d_volume_free(radar);
+		radar = NULL;
+	}
+	g_timer_destroy(stream->timer);
+	g_free(stream->site);
+	g_free(stream->file);
+	g_free(stream->part);
+	g_free(stream);
+	return radar;
+}
+
+/* Decoded volumes are cached next to the downloaded file, which is named
+ * after the site and scan time. The cache is only used if it's newer than
+ * the file, so a volume that was downloaded again gets decoded again. */
+static gchar *_cache_path(const gchar *file)
+{
+	return g_strconcat(file, ".vol", NULL);
+}
+
+static Wsr88dVolume *_load_cache(const gchar *file, const gchar *site)
+{
+	struct stat fst, cst;
+	gchar *cache = _cache_path(file);
+	Wsr88dVolume *radar = NULL;
+	if (g_stat(file, &fst) == 0 && g_stat(cache, &cst) == 0 &&
+	    cst.st_mtime >= fst.st_mtime)
+		radar = wsr88d_volume_map(cache);
+	if (radar && site && !g_str_equal(radar->site, site)) {
+		wsr88d_volume_free(radar);
+		radar = NULL;
+	}
+	if (radar)
+		g_debug("AWeatherLevel2: _load_cache - %s", cache);
+	g_free(cache);
+	return radar;
+}
+
+static Wsr88dVolume *_load_radar(const gchar *file, const gchar *site)
+{
+	g_debug("AWeatherLevel2: _load_radar - %s", file);
+	AWeatherLevel2Stream *stream = _stream_new(site);
+	_stream_read(stream, file);
+	return _stream_close(stream);
+}
+
+/* Load the radar into an isosurface grid. The reflectivity sweeps are
+ * resampled onto a Cartesian grid centered on the radar, with x east, y
+ * north and z up, the same as the sweeps are drawn. Each grid point looks
+ * up the ray covering its azimuth and the gate at its range in the sweeps
+ * above and below it, then interpolates between them by elevation. Rows of
+ * the grid are split between worker threads. */
+typedef struct {
+	Wsr88dSweep *sweep;
+	gint         rays[3600]; // Ray covering each tenth of a degree, or -1
+} GridSweep;
+
+typedef struct {
+	RadarIsoGrid *grid;
+	GridSweep    *sweeps;    // Lowest first, one per elevation
+	gint          nsweeps;
+	gint          y0, y1;    // Rows for this block
+} GridBlock;
+
+static void _grid_sweep(GridSweep *gs, Wsr88dSweep *sweep)
+{
+	gs->sweep = sweep;
+	for (int i = 0; i < 3600; i++)
+		gs->rays[i] = -1;
+	for (guint ri = 0; ri < sweep->nrays; ri++) {
+		gint a = (sweep->rays[ri].azimuth - sweep->beam_width/2) * 10;
+		gint b = (sweep->rays[ri].azimuth + sweep->beam_width/2) * 10;
+		for (gint ai = a; ai <= b; ai++)
+			gs->rays[(ai+3600) % 3600] = ri;
+	}
+}
+
+static gfloat _grid_value(GridSweep *gs, gint ai, gdouble range)
+{
+	Wsr88dSweep *sweep = gs->sweep;
+	gint ri = gs->rays[ai];
+	gint gi = floor((range - sweep->range_bin1) / sweep->gate_size + 0.5);
+	if (ri < 0 || gi < 0 || gi >= sweep->ngates)
+		return 0;
+	guint8 code = sweep->data[ri*sweep->ngates + gi];
+	if (code == WSR88D_BELOW_THRESHOLD ||
+	    code == WSR88D_RANGE_FOLDED)
+		return 0;
+	gfloat val = wsr88d_sweep_value(sweep, code);
+	return val > 80 ? 0 : val;
+}
+
+static void _grid_block(gpointer _block, gpointer user_data)
+{
+	GridBlock    *block  = _block;
+	RadarIsoGrid *grid   = block->grid;
+	GridSweep    *sweeps = block->sweeps;
+	gint          n      = block->nsweeps;
+	gdouble       bottom = sweeps[0].sweep->elev   - sweeps[0].sweep->beam_width/2;
+	gdouble       top    = sweeps[n-1].sweep->elev + sweeps[n-1].sweep->beam_width/2;
+	for (gint zi = 0;        zi < grid->zs; zi++)
+	for (gint yi = block->y0; yi < block->y1; yi++)
+	for (gint xi = 0;        xi < grid->xs; xi++) {
+		gdouble x = (xi - grid->xs/2) * grid->res;
+		gdouble y = (yi - grid->ys/2) * grid->res;
+		gdouble z = zi * grid->res;
+		gdouble ground = hypot(x, y);
+		gdouble range  = hypot(ground, z);
+		gdouble elev   = rad2deg(atan2(z, ground));
+		gint    ai     = (gint)(rad2deg(atan2(x, y))*10 + 3600) % 3600;
+		gfloat  value  = 0;
+		if (elev >= bottom && elev <= top) {
+			gint si = 0;
+			while (si < n-1 && sweeps[si+1].sweep->elev <= elev)
+				si++;
+			gdouble below = sweeps[si].sweep->elev;
+			if (si == n-1 || elev <= below) {
+				value = _grid_value(&sweeps[si], ai, range);
+			} else {
+				gdouble above = sweeps[si+1].sweep->elev;
+				gdouble w     = (elev - below) / (above - below);
+				value = (1-w) * _grid_value(&sweeps[si],   ai, range) +
+				           w  * _grid_value(&sweeps[si+1], ai, range);
+			}
+		}
+		radar_iso_grid_set(grid, xi, yi, zi, value);
+	}
+}
+
+static RadarIsoGrid *_load_grid(Wsr88dVolume *radar, gdouble res)
+{
+	g_debug("AWeatherLevel2: _load_grid - %.0f m", res);
+	GTimer *timer = g_timer_new();
+
+	/* Reflectivity sweeps, lowest first. Split cuts have two at the same
+	 * elevation, keep the one with the longest range. */
+	GArray *sweeps = g_array_new(FALSE, FALSE, sizeof(Wsr88dSweep*));
+	for (guint i = 0; i < radar->nsweeps; i++) {
+		Wsr88dSweep *sweep = radar->sweeps[i];
+		if (sweep->moment != WSR88D_REF || sweep->nrays == 0 ||
+		    !wsr88d_volume_load_sweep(radar, sweep))
+			continue;
+		guint j = 0;
+		while (j < sweeps->len &&
+		       g_array_index(sweeps, Wsr88dSweep*, j)->elev < sweep->elev - 0.1)
+			j++;
+		Wsr88dSweep **same = j < sweeps->len ?
+			&g_array_index(sweeps, Wsr88dSweep*, j) : NULL;
+		if (same && fabs((*same)->elev - sweep->elev) <= 0.1) {
+			if (sweep->ngates*sweep->gate_size > (*same)->ngates*(*same)->gate_size)
+				*same = sweep;
+		} else {
+			g_array_insert_val(sweeps, j, sweep);
+		}
+	}
+	if (sweeps->len == 0) {
+		g_array_free(sweeps, TRUE);
+		g_timer_destroy(timer);
+		return NULL;
+	}
+
+	/* Cover the full range of the sweeps */
+	gint       nsweeps = sweeps->len;
+	GridSweep *grids   = g_new0(GridSweep, nsweeps);
+	gdouble    range   = 0;
+	for (gint si = 0; si < nsweeps; si++) {
+		Wsr88dSweep *sweep = g_array_index(sweeps, Wsr88dSweep*, si);
+		_grid_sweep(&grids[si], sweep);
+		range = MAX(range, sweep->range_bin1 + sweep->ngates*sweep->gate_size);
+	}
+	g_array_free(sweeps, TRUE);
+	gint size = 2*ceil(range/res) + 1;
+	RadarIsoGrid *grid = radar_iso_grid_new(size, size, ceil(ISO_TOP/res) + 1, res);
+
+	/* Resample */
+	gint threads = _cpu_threads();
+	gint nblocks = MIN(threads*4, grid->ys);
+	GridBlock *blocks = g_new0(GridBlock, nblocks);
+	for (gint b = 0; b < nblocks; b++) {
+		blocks[b].grid    = grid;
+		blocks[b].sweeps  = grids;
+		blocks[b].nsweeps = nsweeps;
+		blocks[b].y0      = grid->ys *  b    / nblocks;
+		blocks[b].y1      = grid->ys * (b+1) / nblocks;
+	}
+	if (threads <= 1) {
+		for (gint b = 0; b < nblocks; b++)
+			_grid_block(&blocks[b], NULL);
+	} else {
+		GThreadPool *pool = g_thread_pool_new(_grid_block, NULL,
+				threads, FALSE, NULL);
+		for (gint b = 0; b < nblocks; b++)
+			g_thread_pool_push(pool, &blocks[b], NULL);
+		g_thread_pool_free(pool, FALSE, TRUE);
 	}
+	radar_iso_grid_finish(grid);
+	g_debug("AWeatherLevel2: _load_grid - %dx%dx%d from %d sweeps "
+			"in %.1f ms, %d threads, %.1f MB",
+			grid->xs, grid->ys, grid->zs, nsweeps,
+			g_timer_elapsed(timer, NULL)*1000, threads,
+			radar_iso_grid_size(grid)/1e6);
+	g_free(blocks);
+	g_free(grids);
+	g_timer_destroy(timer);
 	return grid;
 }
 
 
+/* An extracted isosurface and its vertex buffer, see set_iso */
+struct _AWeatherLevel2Iso {
+	AWeatherLevel2  *level2;
+	gint             key;       // Level in slider steps
+	RadarIsoSurface *surface;
+	guint            vbo;
+	guint            ibo;       // Triangle indices into vbo
+	RadarTextureUse *use;
+};
+
+/* Slider steps are 0.5 dBZ */
+static gint _iso_key(gfloat level)
+{
+	return lround(level*2);
+}
+
+
 /*********************
  * Drawing functions *
  *********************/
-void aweather_level2_draw(GritsObject *_level2, GritsOpenGL *opengl)
+static void _push_sweep_job(AWeatherLevel2 *level2, guint si, guint serial);
+static gboolean _reload_iso_cb(gpointer _level2);
+
+static void _draw_sweep(AWeatherLevel2 *level2)
 {
-	AWeatherLevel2 *level2 = AWEATHER_LEVEL2(_level2);
-	if (!level2->sweep || !level2->sweep_tex)
+	guint si = level2->sweep_si;
+	if (!level2->sweep || !level2->sweep_texs[si])
 		return;
+	radar_texture_touch(level2->sweep_uses[si]);
 
 	/* Draw wsr88d */
-	Sweep *sweep = level2->sweep;
+	Wsr88dSweep *sweep = level2->sweep;
 	//glDisable(GL_ALPHA_TEST);
 	glDisable(GL_CULL_FACE);
 	glDisable(GL_LIGHTING);
@@ -219,40 +622,37 @@ void aweather_level2_draw(GritsObject *_level2, GritsOpenGL *opengl)
 	glColor4f(1,1,1,1);
 
 	/* Draw the rays */
-	gdouble xscale = level2->sweep_coords[0];
-	gdouble yscale = level2->sweep_coords[1];
-	glBindTexture(GL_TEXTURE_2D, level2->sweep_tex);
-	glBegin(GL_TRIANGLE_STRIP);
-	for (int ri = 0; ri <= sweep->h.nrays; ri++) {
-		Ray  *ray = NULL;
-		double angle = 0;
-		if (ri < sweep->h.nrays) {
-			ray = sweep->ray[ri];
-			angle = deg2rad(ray->h.azimuth - ((double)ray->h.beam_width/2.));
-		} else {
-			/* Do the right side of the last sweep */
-			ray = sweep->ray[ri-1];
-			angle = deg2rad(ray->h.azimuth + ((double)ray->h.beam_width/2.));
-		}
-
-		double lx = sin(angle);
-		double ly = cos(angle);
-
-		double near_dist = ray->h.range_bin1 - ((double)ray->h.gate_size/2.);
-		double far_dist  = near_dist + (double)ray->h.nbins*ray->h.gate_size;
-
-		/* (find middle of bin) / scale for opengl */
-		// near left
-		glTexCoord2f(0.0, ((double)ri/sweep->h.nrays)*yscale);
-		glVertex3f(lx*near_dist, ly*near_dist, 2.0);
-
-		// far  left
-		// todo: correct range-height function
-		double height = sin(deg2rad(ray->h.elev)) * far_dist;
-		glTexCoord2f(xscale, ((double)ri/sweep->h.nrays)*yscale);
-		glVertex3f(lx*far_dist,  ly*far_dist, height);
+#ifdef GL_VERSION_2_0
+	if (level2->sweep_pal) {
+		radar_gl.UseProgram(sweep_program);
+		radar_gl.ActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_1D, level2->sweep_pal);
+		radar_gl.ActiveTexture(GL_TEXTURE0);
+	}
+#endif
+	glBindTexture(GL_TEXTURE_2D, level2->sweep_texs[si]);
+	gfloat *mesh = level2->sweep_meshes[si];
+#ifdef GL_VERSION_1_5
+	if (level2->sweep_vbos[si]) {
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, level2->sweep_vbos[si]);
+		mesh = NULL;
 	}
-	glEnd();
+#endif
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, MESH_STRIDE*sizeof(gfloat), mesh);
+	glVertexPointer  (3, GL_FLOAT, MESH_STRIDE*sizeof(gfloat), mesh+2);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, (sweep->nrays+1)*2);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+#ifdef GL_VERSION_1_5
+	if (level2->sweep_vbos[si])
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+#ifdef GL_VERSION_2_0
+	if (level2->sweep_pal)
+		radar_gl.UseProgram(0);
+#endif
 	//g_print("ri=%d, nr=%d, bw=%f\n", _ri, sweep->h.nrays, sweep->h.beam_width);
 
 	/* Texture debug */
@@ -264,128 +664,617 @@ void aweather_level2_draw(GritsObject *_level2, GritsOpenGL *opengl)
 	//glEnd();
 }
 
-void aweather_level2_hide(GritsObject *_level2, gboolean hidden)
+static void _draw_iso_surface(AWeatherLevel2 *level2, AWeatherLevel2Iso *iso,
+		gfloat alpha)
+{
+	if (iso->use)
+		radar_texture_touch(iso->use);
+	guint8 *color = colormap_get(&level2->colormap[0], iso->surface->level);
+	glColor4ub(color[0], color[1], color[2], color[3]*alpha);
+
+	gfloat *data    = iso->surface->data;
+	guint  *indices = iso->surface->indices;
+#ifdef GL_VERSION_1_5
+	if (iso->vbo) {
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, iso->vbo);
+		radar_gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, iso->ibo);
+		data    = NULL;
+		indices = NULL;
+	}
+#endif
+	glVertexPointer(3, GL_FLOAT, RADAR_ISO_STRIDE*sizeof(gfloat), data);
+	glNormalPointer(   GL_FLOAT, RADAR_ISO_STRIDE*sizeof(gfloat), data+3);
+	glDrawElements(GL_TRIANGLES, iso->surface->nindices,
+			GL_UNSIGNED_INT, indices);
+#ifdef GL_VERSION_1_5
+	if (iso->vbo) {
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+		radar_gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+#endif
+}
+
+static void _draw_iso(AWeatherLevel2 *level2)
+{
+	/* Shells are drawn innermost first, at half their usual opacity so
+	 * the inner ones show through the outer ones */
+	AWeatherLevel2Iso *isos[ISO_SHELLS];
+	gint n = 0;
+	if (level2->iso_shells) {
+		for (gint i = ISO_SHELLS-1; i >= 0; i--)
+			if ((isos[n] = g_hash_table_lookup(level2->iso_cache,
+					GINT_TO_POINTER(_iso_key(iso_shells[i])))))
+				n++;
+	} else if (level2->iso_shown) {
+		isos[n++] = level2->iso_shown;
+	}
+	if (n == 0)
+		return;
+	if (level2->iso_grid_use)
+		radar_texture_touch(level2->iso_grid_use);
+
+	/* Lit from the front on both sides, the surface is translucent so it
+	 * doesn't hide anything drawn after it */
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_LIGHTING);
+	glEnable(GL_LIGHT0);
+	glEnable(GL_COLOR_MATERIAL);
+	glEnable(GL_NORMALIZE);
+	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+	glDepthMask(GL_FALSE);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+
+	for (gint i = 0; i < n; i++)
+		_draw_iso_surface(level2, isos[i], level2->iso_shells ? 0.5 : 1);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDepthMask(GL_TRUE);
+	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_FALSE);
+	glDisable(GL_NORMALIZE);
+	glDisable(GL_COLOR_MATERIAL);
+	glDisable(GL_LIGHTING);
+}
+
+void aweather_level2_draw(GritsObject *_level2, GritsOpenGL *opengl)
 {
 	AWeatherLevel2 *level2 = AWEATHER_LEVEL2(_level2);
-	if (level2->volume)
-		grits_object_hide(GRITS_OBJECT(level2->volume), hidden);
+	if (level2->iso_evicted) {
+		level2->iso_evicted = FALSE;
+		g_idle_add(_reload_iso_cb, g_object_ref(level2));
+	}
+	if (level2->sweep_evicted) {
+		level2->sweep_evicted = FALSE;
+		_push_sweep_job(level2, level2->sweep_si,
+			g_atomic_int_exchange_and_add(&level2->sweep_serial, 1) + 1);
+	}
+	_draw_sweep(level2);
+	_draw_iso(level2);
 }
 
 
 /***********
  * Methods *
  ***********/
-static gboolean _set_sweep_cb(gpointer _level2)
+/* Sweeps are decoded on a worker thread, and converted there too if there
+ * are no shaders, then passed back to the main thread to be uploaded. Each
+ * request gets a serial number and anything older than the latest request
+ * is dropped. Once the volume is loaded the remaining sweeps are prefetched
+ * the same way, with serial 0, after any requests. */
+typedef struct {
+	AWeatherLevel2   *level2;
+	guint             serial;
+	guint             si;       // Index of the sweep in the volume
+	Wsr88dSweep      *sweep;
+	AWeatherColormap *colors;
+	gboolean          loaded;
+	guint8           *data;     // RGBA, only without shaders
+	gint              width;
+	gint              height;
+	RadarTextureBuffer *buffer; // Texels written by the worker, or NULL
+} SweepJob;
+
+static gboolean _sweep_job_stale(SweepJob *job)
 {
-	g_debug("AWeatherLevel2: _set_sweep_cb");
-	AWeatherLevel2 *level2 = _level2;
-	_load_sweep_gl(level2);
-	grits_object_queue_draw(_level2);
+	if (g_atomic_int_get(&job->level2->disposed))
+		return TRUE;
+	return job->serial &&
+		job->serial != (guint)g_atomic_int_get(&job->level2->sweep_serial);
+}
+
+static gint _sweep_job_sort(gconstpointer _a, gconstpointer _b, gpointer data)
+{
+	const SweepJob *a = _a, *b = _b;
+	return a->serial > b->serial ? -1 :
+	       a->serial < b->serial ?  1 : (gint)a->si - (gint)b->si;
+}
+
+static AWeatherColormap *_sweep_colors(AWeatherLevel2 *level2, int type)
+{
+	for (int i = 0; level2->colormap[i].file; i++)
+		if (level2->colormap[i].type == type)
+			return &level2->colormap[i];
+	g_warning("AWeatherLevel2: set_sweep - missing colormap[%d]", type);
+	return &level2->colormap[0];
+}
+
+/* Show a sweep which already has a texture */
+static void _show_sweep(AWeatherLevel2 *level2, guint si)
+{
+	level2->sweep            = level2->radar->sweeps[si];
+	level2->sweep_colors     = _sweep_colors(level2, level2->sweep->moment);
+	level2->sweep_si         = si;
+	level2->sweep_evicted    = FALSE;
+	if (sweep_program)
+		_load_palette_gl(level2);
+	grits_object_queue_draw(GRITS_OBJECT(level2));
+}
+
+static gboolean _set_sweep_cb(gpointer _job)
+{
+	SweepJob       *job    = _job;
+	AWeatherLevel2 *level2 = job->level2;
+	g_debug("AWeatherLevel2: _set_sweep_cb - %u/%u%s", job->serial, job->si,
+			_sweep_job_stale(job) ? " (stale)" :
+			!job->loaded          ? " (failed)" : "");
+	if (job->loaded && !level2->sweep_texs[job->si] && !level2->disposed) {
+		if (_sweep_program()) {
+			_load_sweep_gl(level2, job->si, job->sweep->data, job->buffer,
+					GL_LUMINANCE, job->sweep->ngates, job->sweep->nrays);
+			job->buffer = NULL;
+		} else if (job->data || !_sweep_job_stale(job)) {
+			/* Jobs from before the shader was tried aren't converted */
+			if (!job->data)
+				_bscan_sweep(job->sweep, job->colors,
+						&job->data, &job->width, &job->height);
+			_load_sweep_gl(level2, job->si, job->data, job->buffer,
+					GL_RGBA, job->width, job->height);
+			job->buffer = NULL;
+		}
+	}
+	if (job->buffer)
+		radar_texture_unmap(job->buffer);
+	if (job->serial && !_sweep_job_stale(job) && level2->sweep_texs[job->si])
+		_show_sweep(level2, job->si);
+	g_free(job->data);
+	g_free(job);
 	g_object_unref(level2);
 	return FALSE;
 }
+
+static void _sweep_job(gpointer _job, gpointer user_data)
+{
+	SweepJob *job = _job;
+	if (!_sweep_job_stale(job))
+		job->loaded = wsr88d_volume_load_sweep(job->level2->radar, job->sweep);
+	if (job->loaded && !_sweep_job_stale(job) &&
+	    g_atomic_int_get(&sweep_program_state) < 0)
+		_bscan_sweep(job->sweep, job->colors,
+				&job->data, &job->width, &job->height);
+	/* Write the texels into a pixel buffer here so the main thread only
+	 * starts the transfer. Until the shader has been tried it's not known
+	 * which texels are needed, so those are uploaded from memory. */
+	if (job->loaded && !_sweep_job_stale(job) &&
+	    g_atomic_int_get(&sweep_program_state)) {
+		guint8 *texels = job->data ?: job->sweep->data;
+		gsize   size   = job->data ? (gsize)job->width*job->height*4
+		                           : (gsize)job->sweep->ngates*job->sweep->nrays;
+		if ((job->buffer = radar_texture_map(size)))
+			memcpy(radar_texture_buffer_data(job->buffer), texels, size);
+	}
+	/* The level2 must be unreferenced in the main thread */
+	g_idle_add(_set_sweep_cb, job);
+}
+
+static void _push_sweep_job(AWeatherLevel2 *level2, guint si, guint serial)
+{
+	SweepJob *job = g_new0(SweepJob, 1);
+	job->level2 = g_object_ref(level2);
+	job->serial = serial;
+	job->si     = si;
+	job->sweep  = level2->radar->sweeps[si];
+	job->colors = _sweep_colors(level2, job->sweep->moment);
+	g_thread_pool_push(level2->sweep_pool, job, NULL);
+}
+
+/* Convert every sweep that doesn't have a texture yet */
+static void _prefetch_sweeps(AWeatherLevel2 *level2)
+{
+	for (guint si = 0; si < level2->radar->nsweeps; si++)
+		if (!level2->sweep_texs[si])
+			_push_sweep_job(level2, si, 0);
+}
+
 void aweather_level2_set_sweep(AWeatherLevel2 *level2,
 		int type, float elev)
 {
 	g_debug("AWeatherLevel2: set_sweep - %d %f", type, elev);
 
 	/* Find sweep */
-	Volume *volume = RSL_get_volume(level2->radar, type);
-	if (!volume) return;
-	level2->sweep = RSL_get_closest_sweep(volume, elev, 90);
-	if (!level2->sweep) return;
+	Wsr88dSweep *sweep = wsr88d_volume_get_sweep(level2->radar, type, elev);
+	if (!sweep) return;
+	guint si = 0;
+	while (level2->radar->sweeps[si] != sweep)
+		si++;
 
-	/* Find colormap */
-	level2->sweep_colors = NULL;
-	for (int i = 0; level2->colormap[i].file; i++)
-		if (level2->colormap[i].type == type)
-			level2->sweep_colors = &level2->colormap[i];
-	if (!level2->sweep_colors) {
-		g_warning("AWeatherLevel2: set_sweep - missing colormap[%d]", type);
-		level2->sweep_colors = &level2->colormap[0];
+	/* Replace any earlier request, then either show the texture or have
+	 * the worker convert the sweep, decoding it if the loader hasn't got
+	 * to it yet */
+	guint serial = g_atomic_int_exchange_and_add(&level2->sweep_serial, 1) + 1;
+	if (level2->sweep_texs[si])
+		_show_sweep(level2, si);
+	else
+		_push_sweep_job(level2, si, serial);
+}
+
+/* Isosurfaces are extracted on a worker thread and cached by level. Only
+ * one extraction runs at a time, if the level changes while it runs only
+ * the newest level is extracted after it, so dragging the slider doesn't
+ * queue up every level it passes. The grid is resampled by the first
+ * extraction and kept for the next ones. Surfaces and the grid are counted
+ * in the texture budget.
+ *
+ * Each extraction first does a preview from a grid with four times the
+ * spacing, which is quick to resample, and shows that until the full
+ * surface is ready.
+ *
+ * With shells turned on a fixed set of nested levels is shown instead of
+ * the slider level. The missing ones are extracted together in one job,
+ * using one pass over the grid, and cached the same as slider levels. */
+#define ISO_COARSE 4
+
+typedef struct {
+	AWeatherLevel2  *level2;
+	gfloat           levels[ISO_SHELLS];
+	gint             nlevels;
+	GTimer          *timer;    // Since set_iso
+	RadarIsoGrid    *grid;     // From the level2, or resampled by the job
+	RadarIsoGrid    *coarse;
+	RadarIsoSurface *surfaces[ISO_SHELLS];
+} IsoJob;
+
+static void _iso_free(gpointer _iso)
+{
+	AWeatherLevel2Iso *iso = _iso;
+	if (iso->level2->iso_shown == iso)
+		iso->level2->iso_shown = NULL;
+#ifdef GL_VERSION_1_5
+	if (iso->vbo) {
+		radar_gl.DeleteBuffers(1, &iso->vbo);
+		radar_gl.DeleteBuffers(1, &iso->ibo);
 	}
+#endif
+	radar_iso_surface_free(iso->surface);
+	g_free(iso);
+}
 
-	/* Load data */
-	g_object_ref(level2);
-	g_idle_add(_set_sweep_cb, level2);
+static void _evict_iso(gpointer _level2, guint key)
+{
+	AWeatherLevel2 *level2 = _level2;
+	AWeatherLevel2Iso *iso = g_hash_table_lookup(level2->iso_cache,
+			GINT_TO_POINTER(key));
+	if (iso == level2->iso_shown || level2->iso_shells)
+		level2->iso_evicted = TRUE;
+	iso->use = NULL;
+	g_hash_table_remove(level2->iso_cache, GINT_TO_POINTER(key));
 }
 
-void aweather_level2_set_iso(AWeatherLevel2 *level2, gfloat level)
+static void _evict_iso_grid(gpointer _level2, guint index)
 {
-	g_debug("AWeatherLevel2: set_iso - %f", level);
+	AWeatherLevel2 *level2 = _level2;
+	radar_iso_grid_unref(level2->iso_grid);
+	radar_iso_grid_unref(level2->iso_coarse);
+	level2->iso_grid     = NULL;
+	level2->iso_coarse   = NULL;
+	level2->iso_grid_use = NULL;
+}
+
+static AWeatherLevel2Iso *_iso_new(AWeatherLevel2 *level2,
+		RadarIsoSurface *surface)
+{
+	AWeatherLevel2Iso *iso = g_new0(AWeatherLevel2Iso, 1);
+	iso->level2  = level2;
+	iso->key     = _iso_key(surface->level);
+	iso->surface = surface;
+#ifdef GL_VERSION_1_5
+	gsize size = surface->nverts*RADAR_ISO_STRIDE*sizeof(gfloat);
+	if (radar_gl_buffers() && size > 0) {
+		radar_gl.GenBuffers(1, &iso->vbo);
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, iso->vbo);
+		radar_gl.BufferData(GL_ARRAY_BUFFER, size, surface->data, GL_STATIC_DRAW);
+		radar_gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+		radar_gl.GenBuffers(1, &iso->ibo);
+		radar_gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, iso->ibo);
+		radar_gl.BufferData(GL_ELEMENT_ARRAY_BUFFER, surface->nindices*sizeof(guint),
+				surface->indices, GL_STATIC_DRAW);
+		radar_gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+#endif
+	return iso;
+}
 
-	if (!level2->volume) {
-		g_debug("AWeatherLevel2: set_iso - creating new volume");
-		Volume      *rvol = RSL_get_volume(level2->radar, DZ_INDEX);
-		VolGrid     *grid = _load_grid(rvol);
-		GritsVolume *vol  = grits_volume_new(grid);
-		vol->proj = GRITS_VOLUME_CARTESIAN;
-		vol->disp = GRITS_VOLUME_SURFACE;
-		GRITS_OBJECT(vol)->center = GRITS_OBJECT(level2)->center;
-		grits_viewer_add(GRITS_OBJECT(level2)->viewer,
-				GRITS_OBJECT(vol), GRITS_LEVEL_WORLD+5, TRUE);
-		level2->volume = vol;
-	}
-	if (ISO_MIN < level && level < ISO_MAX) {
-		guint8 *data = colormap_get(&level2->colormap[0], level);
-		level2->volume->color[0] = data[0];
-		level2->volume->color[1] = data[1];
-		level2->volume->color[2] = data[2];
-		level2->volume->color[3] = data[3];
-		grits_volume_set_level(level2->volume, level);
-		grits_object_hide(GRITS_OBJECT(level2->volume), FALSE);
+/* Show the coarse surface if the level hasn't changed */
+static gboolean _iso_preview_cb(gpointer _job)
+{
+	IsoJob         *job    = _job;
+	AWeatherLevel2 *level2 = job->level2;
+	if (job->surfaces[0] && _iso_key(job->levels[0]) == _iso_key(level2->iso)) {
+		g_debug("AWeatherLevel2: set_iso - %.1f first surface in %.1f ms",
+				job->levels[0], g_timer_elapsed(job->timer, NULL)*1000);
+		if (level2->iso_preview)
+			_iso_free(level2->iso_preview);
+		level2->iso_preview = _iso_new(level2, job->surfaces[0]);
+		level2->iso_shown   = level2->iso_preview;
+		grits_object_queue_draw(GRITS_OBJECT(level2));
 	} else {
-		grits_object_hide(GRITS_OBJECT(level2->volume), TRUE);
+		radar_iso_surface_free(job->surfaces[0]);
+	}
+	g_free(job);
+	g_object_unref(level2);
+	return FALSE;
+}
+
+static gboolean _reload_iso_cb(gpointer _level2)
+{
+	AWeatherLevel2 *level2 = _level2;
+	aweather_level2_set_iso(level2, level2->iso);
+	g_object_unref(level2);
+	return FALSE;
+}
+
+static gboolean _iso_done_cb(gpointer _job)
+{
+	IsoJob         *job    = _job;
+	AWeatherLevel2 *level2 = job->level2;
+	level2->iso_busy = FALSE;
+
+	/* Keep the grids for the next level */
+	if (job->grid && job->coarse && !level2->iso_grid) {
+		level2->iso_grid     = radar_iso_grid_ref(job->grid);
+		level2->iso_coarse   = radar_iso_grid_ref(job->coarse);
+		level2->iso_grid_use = radar_texture_track(
+				radar_iso_grid_size(job->grid) +
+				radar_iso_grid_size(job->coarse),
+				_evict_iso_grid, level2, 0);
+	}
+	radar_iso_grid_unref(job->grid);
+	radar_iso_grid_unref(job->coarse);
+
+	/* Cache the surfaces, the preview isn't needed any more */
+	if (level2->iso_preview) {
+		_iso_free(level2->iso_preview);
+		level2->iso_preview = NULL;
+	}
+	for (gint l = 0; l < job->nlevels && job->surfaces[l]; l++) {
+		g_debug("AWeatherLevel2: set_iso - %.1f final surface in %.1f ms",
+				job->levels[l], g_timer_elapsed(job->timer, NULL)*1000);
+		AWeatherLevel2Iso *iso = _iso_new(level2, job->surfaces[l]);
+		g_hash_table_insert(level2->iso_cache,
+				GINT_TO_POINTER(iso->key), iso);
+		iso->use = radar_texture_track(
+				radar_iso_surface_size(iso->surface),
+				_evict_iso, level2, iso->key);
+	}
+	g_timer_destroy(job->timer);
+
+	/* Show them, or start on the newest levels. Don't retry if the grid
+	 * failed, that only happens if there's no reflectivity. */
+	if (job->grid)
+		aweather_level2_set_iso(level2, level2->iso);
+	g_free(job);
+	g_object_unref(level2);
+	return FALSE;
+}
+
+static void _iso_job(gpointer _job, gpointer user_data)
+{
+	IsoJob         *job    = _job;
+	AWeatherLevel2 *level2 = job->level2;
+	gdouble         res    = level2->iso_resolution;
+
+	/* Preview */
+	if (!job->coarse)
+		job->coarse = _load_grid(level2->radar, res*ISO_COARSE);
+	if (job->coarse && job->nlevels == 1) {
+		IsoJob *preview = g_memdup(job, sizeof(IsoJob));
+		g_object_ref(preview->level2);
+		preview->surfaces[0] = radar_iso_extract(job->coarse, job->levels[0]);
+		g_idle_add(_iso_preview_cb, preview);
+	}
+
+	/* Full resolution */
+	if (job->coarse && !job->grid)
+		job->grid = _load_grid(level2->radar, res);
+	if (job->grid)
+		radar_iso_extract_levels(job->grid,
+				job->levels, job->nlevels, job->surfaces);
+	/* The level2 must be unreferenced in the main thread */
+	g_idle_add(_iso_done_cb, job);
+}
+
+/* Start a job for whichever of the levels being shown aren't cached */
+static void _iso_update(AWeatherLevel2 *level2)
+{
+	if (level2->iso_busy)
+		return;
+	IsoJob *job = g_new0(IsoJob, 1);
+	if (level2->iso_shells) {
+		for (gint i = 0; i < ISO_SHELLS; i++)
+			if (!g_hash_table_lookup(level2->iso_cache,
+					GINT_TO_POINTER(_iso_key(iso_shells[i]))))
+				job->levels[job->nlevels++] = iso_shells[i];
+	} else if (ISO_MIN < level2->iso && level2->iso < ISO_MAX) {
+		if (!g_hash_table_lookup(level2->iso_cache,
+				GINT_TO_POINTER(_iso_key(level2->iso))))
+			job->levels[job->nlevels++] = level2->iso;
+	}
+	if (job->nlevels == 0) {
+		g_free(job);
+		return;
 	}
+	job->level2 = g_object_ref(level2);
+	job->timer  = g_timer_new();
+	if (level2->iso_grid) {
+		job->grid   = radar_iso_grid_ref(level2->iso_grid);
+		job->coarse = radar_iso_grid_ref(level2->iso_coarse);
+	}
+	level2->iso_busy = TRUE;
+	g_thread_pool_push(level2->iso_pool, job, NULL);
 }
 
-AWeatherLevel2 *aweather_level2_new(Radar *radar, AWeatherColormap *colormap)
+void aweather_level2_set_iso(AWeatherLevel2 *level2, gfloat level)
+{
+	g_debug("AWeatherLevel2: set_iso - %f", level);
+	level2->iso = level;
+
+	AWeatherLevel2Iso *iso = NULL;
+	if (ISO_MIN < level && level < ISO_MAX)
+		iso = g_hash_table_lookup(level2->iso_cache,
+				GINT_TO_POINTER(_iso_key(level)));
+	/* Keep showing the last surface until the new one is ready */
+	if (iso || !(ISO_MIN < level && level < ISO_MAX))
+		level2->iso_shown = iso;
+	_iso_update(level2);
+	grits_object_queue_draw(GRITS_OBJECT(level2));
+}
+
+void aweather_level2_set_iso_shells(AWeatherLevel2 *level2, gboolean shells)
+{
+	g_debug("AWeatherLevel2: set_iso_shells - %d", shells);
+	level2->iso_shells = shells;
+	_iso_update(level2);
+	grits_object_queue_draw(GRITS_OBJECT(level2));
+}
+
+static gboolean _load_done_cb(gpointer _level2)
+{
+	AWeatherLevel2 *level2 = _level2;
+	if (!level2->disposed)
+		_prefetch_sweeps(level2);
+	g_object_unref(level2);
+	return FALSE;
+}
+static gpointer _load_thread(gpointer _level2)
+{
+	AWeatherLevel2 *level2 = _level2;
+	GTimer *timer = g_timer_new();
+	wsr88d_volume_load_all(level2->radar);
+	g_debug("AWeatherLevel2: _load_thread - loaded %d sweeps in %.1f ms",
+			level2->radar->nsweeps, g_timer_elapsed(timer, NULL)*1000);
+	g_timer_destroy(timer);
+	if (level2->cache)
+		wsr88d_volume_save(level2->radar, level2->cache);
+	/* Finalize must run in the main thread */
+	g_idle_add(_load_done_cb, level2);
+	return NULL;
+}
+static AWeatherLevel2 *_level2_new(Wsr88dVolume *radar,
+		AWeatherColormap *colormap, gchar *cache)
 {
-	g_debug("AWeatherLevel2: new - %s", radar->h.radar_name);
-	RSL_sort_radar(radar);
+	g_debug("AWeatherLevel2: new - %s", radar->site);
 	AWeatherLevel2 *level2 = g_object_new(AWEATHER_TYPE_LEVEL2, NULL);
 	level2->radar    = radar;
 	level2->colormap = colormap;
-	aweather_level2_set_sweep(level2, DZ_INDEX, 0);
+	level2->cache    = cache;
+	level2->iso_resolution  = ISO_RES;
+	level2->sweep_texs      = g_new0(guint, radar->nsweeps);
+	level2->sweep_vbos      = g_new0(guint,   radar->nsweeps);
+	level2->sweep_meshes    = g_new0(gfloat*, radar->nsweeps);
+	level2->sweep_uses      = g_new0(RadarTextureUse*, radar->nsweeps);
+	aweather_level2_set_sweep(level2, WSR88D_REF, 0);
 
+	/* Decode the rest of the sweeps in the background */
+	g_thread_create(_load_thread, g_object_ref(level2), FALSE, NULL);
+
+	/* Older volumes don't include the location of the radar */
 	GritsPoint center;
-	Radar_header *h = &radar->h;
-	center.lat  = (double)h->latd + (double)h->latm/60 + (double)h->lats/(60*60);
-	center.lon  = (double)h->lond + (double)h->lonm/60 + (double)h->lons/(60*60);
-	center.elev = h->height;
+	center.lat  = radar->lat;
+	center.lon  = radar->lon;
+	center.elev = radar->height;
+	if (!radar->located)
+		for (city_t *city = cities; city->type; city++)
+			if (city->code && g_str_equal(city->code, radar->site))
+				center = city->pos;
 	GRITS_OBJECT(level2)->center = center;
 	return level2;
 }
 
+AWeatherLevel2 *aweather_level2_new(Wsr88dVolume *radar, AWeatherColormap *colormap)
+{
+	return _level2_new(radar, colormap, NULL);
+}
+
+AWeatherLevel2Stream *aweather_level2_stream_new(const gchar *site)
+{
+	g_debug("AWeatherLevel2: stream_new %s", site);
+	return _stream_new(site);
+}
+
+void aweather_level2_stream_update(AWeatherLevel2Stream *stream, const gchar *file)
+{
+	_stream_read(stream, file);
+}
+
+AWeatherLevel2 *aweather_level2_stream_finish(AWeatherLevel2Stream *stream,
+		const gchar *file, AWeatherColormap *colormap)
+{
+	g_debug("AWeatherLevel2: stream_finish %s %s - %.3fs, "
+			"%d records decoded during the fetch",
+			stream->site, file, g_timer_elapsed(stream->timer, NULL),
+			_stream_records(stream));
+
+	/* Aborted, e.g. the fetch failed */
+	if (!file) {
+		stream->broken = TRUE;
+		_stream_close(stream);
+		return NULL;
+	}
+
+	/* Already decoded, drop anything read so far */
+	Wsr88dVolume *cached = _load_cache(file, stream->site);
+	if (cached) {
+		stream->broken = TRUE;
+		_stream_close(stream);
+		return aweather_level2_new(cached, colormap);
+	}
+
+	/* Read the rest of the file, or all of it if it was already cached */
+	_stream_read(stream, file);
+	gboolean      broken = stream->broken;
+	gchar        *site   = g_strdup(stream->site);
+	Wsr88dVolume *radar  = _stream_close(stream);
+
+	/* The file changed while it was downloading, start over */
+	if (!radar && broken) {
+		g_debug("AWeatherLevel2: stream_finish - reloading %s", file);
+		radar = _load_radar(file, site);
+	}
+	g_free(site);
+	if (!radar)
+		return NULL;
+
+	return _level2_new(radar, colormap, _cache_path(file));
+}
+
 AWeatherLevel2 *aweather_level2_new_from_file(const gchar *file, const gchar *site,
 		AWeatherColormap *colormap)
 {
 	g_debug("AWeatherLevel2: new_from_file %s %s", site, file);
 
-	/* Decompress radar */
-	gchar *raw = g_strconcat(file, ".raw", NULL);
-	if (g_file_test(raw, G_FILE_TEST_EXISTS)) {
-		struct stat files, raws;
-		g_stat(file, &files);
-		g_stat(raw,  &raws);
-		if (files.st_mtime > raws.st_mtime)
-			if (!_decompress_radar(file, raw))
-				return NULL;
-	} else {
-		if (!_decompress_radar(file, raw))
-			return NULL;
-	}
+	/* Use the cache if possible */
+	Wsr88dVolume *radar = _load_cache(file, site);
+	if (radar)
+		return aweather_level2_new(radar, colormap);
 
 	/* Load the radar file */
-	RSL_read_these_sweeps("all", NULL);
-	g_message("read start");
-	Radar *radar = RSL_wsr88d_to_radar(raw, (gchar*)site);
-	g_message("read done");
-	g_free(raw);
+	radar = _load_radar(file, site);
 	if (!radar)
 		return NULL;
 
-	return aweather_level2_new(radar, colormaps);
+	return _level2_new(radar, colormap, _cache_path(file));
 }
 
 static void _on_sweep_clicked(GtkRadioButton *button, gpointer _level2)
@@ -406,85 +1295,117 @@ static void _on_iso_changed(GtkRange *range, gpointer _level2)
 	aweather_level2_set_iso(level2, level);
 }
 
-GtkWidget *aweather_level2_get_config(AWeatherLevel2 *level2)
+static void _on_shells_toggled(GtkWidget *button, gpointer _level2)
+{
+	AWeatherLevel2 *level2 = _level2;
+	gboolean shells = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(button));
+	gtk_widget_set_sensitive(g_object_get_data(G_OBJECT(button), "scale"),
+			!shells);
+	aweather_level2_set_iso_shells(level2, shells);
+}
+
+/* Table of sweeps, the buttons are disabled when there's no level2 to load
+ * them into yet, such as while the volume is still downloading */
+static GtkWidget *_get_config_table(Wsr88dVolume *radar, AWeatherLevel2 *level2)
 {
-	Radar *radar = level2->radar;
-	g_debug("AWeatherLevel2: get_config - %p, %p", level2, radar);
-	/* Clear existing items */
 	gfloat elev;
 	guint rows = 1, cols = 1, cur_cols;
+	gint  type = -1;
 	gchar row_label_str[64], col_label_str[64], button_str[64];
 	GtkWidget *row_label, *col_label, *button = NULL, *elev_box = NULL;
 	GtkWidget *table = gtk_table_new(rows, cols, FALSE);
 
 	/* Add date */
+	struct tm tm;
+	gmtime_r(&radar->time, &tm);
 	gchar *date_str = g_strdup_printf("<b><i>%04d-%02d-%02d %02d:%02d</i></b>",
-			radar->h.year, radar->h.month, radar->h.day+1,
-			radar->h.hour, radar->h.minute);
+			tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min);
 	GtkWidget *date_label = gtk_label_new(date_str);
 	gtk_label_set_use_markup(GTK_LABEL(date_label), TRUE);
 	gtk_table_attach(GTK_TABLE(table), date_label,
 			0,1, 0,1, GTK_FILL,GTK_FILL, 5,0);
 	g_free(date_str);
 
-	/* Add sweeps */
-	for (guint vi = 0; vi < radar->h.nvolumes; vi++) {
-		Volume *vol = radar->v[vi];
-		if (vol == NULL) continue;
-		rows++; cols = 1; elev = 0;
-
-		/* Row label */
-		g_snprintf(row_label_str, 64, "<b>%s:</b>", vol->h.type_str);
-		row_label = gtk_label_new(row_label_str);
-		gtk_label_set_use_markup(GTK_LABEL(row_label), TRUE);
-		gtk_misc_set_alignment(GTK_MISC(row_label), 1, 0.5);
-		gtk_table_attach(GTK_TABLE(table), row_label,
-				0,1, rows-1,rows, GTK_FILL,GTK_FILL, 5,0);
-
-		for (guint si = 0; si < vol->h.nsweeps; si++) {
-			Sweep *sweep = vol->sweep[si];
-			if (sweep == NULL || sweep->h.elev == 0) continue;
-			if (sweep->h.elev != elev) {
-				cols++;
-				elev = sweep->h.elev;
-
-				/* Column label */
-				g_object_get(table, "n-columns", &cur_cols, NULL);
-				if (cols >  cur_cols) {
-					g_snprintf(col_label_str, 64, "<b>%.2f°</b>", elev);
-					col_label = gtk_label_new(col_label_str);
-					gtk_label_set_use_markup(GTK_LABEL(col_label), TRUE);
-					gtk_widget_set_size_request(col_label, 50, -1);
-					gtk_table_attach(GTK_TABLE(table), col_label,
-							cols-1,cols, 0,1, GTK_FILL,GTK_FILL, 0,0);
-				}
-
-				elev_box = gtk_hbox_new(TRUE, 0);
-				gtk_table_attach(GTK_TABLE(table), elev_box,
-						cols-1,cols, rows-1,rows, GTK_FILL,GTK_FILL, 0,0);
+	/* Add sweeps, these are sorted by moment and then elevation */
+	for (guint si = 0; si < radar->nsweeps; si++) {
+		Wsr88dSweep *sweep = radar->sweeps[si];
+		if (sweep->elev == 0) continue;
+		if (sweep->moment != type) {
+			type = sweep->moment;
+			rows++; cols = 1; elev = 0;
+
+			/* Row label */
+			g_snprintf(row_label_str, 64, "<b>%s:</b>",
+					wsr88d_moment_names[type]);
+			row_label = gtk_label_new(row_label_str);
+			gtk_label_set_use_markup(GTK_LABEL(row_label), TRUE);
+			gtk_misc_set_alignment(GTK_MISC(row_label), 1, 0.5);
+			gtk_table_attach(GTK_TABLE(table), row_label,
+					0,1, rows-1,rows, GTK_FILL,GTK_FILL, 5,0);
+		}
+
+		if (sweep->elev != elev) {
+			cols++;
+			elev = sweep->elev;
+
+			/* Column label */
+			g_object_get(table, "n-columns", &cur_cols, NULL);
+			if (cols >  cur_cols) {
+				g_snprintf(col_label_str, 64, "<b>%.2f°</b>", elev);
+				col_label = gtk_label_new(col_label_str);
+				gtk_label_set_use_markup(GTK_LABEL(col_label), TRUE);
+				gtk_widget_set_size_request(col_label, 50, -1);
+				gtk_table_attach(GTK_TABLE(table), col_label,
+						cols-1,cols, 0,1, GTK_FILL,GTK_FILL, 0,0);
 			}
 
+			elev_box = gtk_hbox_new(TRUE, 0);
+			gtk_table_attach(GTK_TABLE(table), elev_box,
+					cols-1,cols, rows-1,rows, GTK_FILL,GTK_FILL, 0,0);
+		}
+
 
-			/* Button */
-			g_snprintf(button_str, 64, "%3.2f", elev);
-			button = gtk_radio_button_new_with_label_from_widget(
-					GTK_RADIO_BUTTON(button), button_str);
-			gtk_widget_set_size_request(button, -1, 26);
-			//button = gtk_radio_button_new_from_widget(GTK_RADIO_BUTTON(button));
-			//gtk_widget_set_size_request(button, -1, 22);
-			g_object_set(button, "draw-indicator", FALSE, NULL);
-			gtk_box_pack_end(GTK_BOX(elev_box), button, TRUE, TRUE, 0);
-
-			g_object_set_data(G_OBJECT(button), "level2", level2);
-			g_object_set_data(G_OBJECT(button), "type", (gpointer)(guintptr)vi);
-			g_object_set_data(G_OBJECT(button), "elev", (gpointer)(guintptr)(elev*100));
-			g_signal_connect(button, "clicked", G_CALLBACK(_on_sweep_clicked), level2);
+		/* Button */
+		g_snprintf(button_str, 64, "%3.2f", elev);
+		button = gtk_radio_button_new_with_label_from_widget(
+				GTK_RADIO_BUTTON(button), button_str);
+		gtk_widget_set_size_request(button, -1, 26);
+		//button = gtk_radio_button_new_from_widget(GTK_RADIO_BUTTON(button));
+		//gtk_widget_set_size_request(button, -1, 22);
+		g_object_set(button, "draw-indicator", FALSE, NULL);
+		gtk_box_pack_end(GTK_BOX(elev_box), button, TRUE, TRUE, 0);
+
+		if (!level2) {
+			gchar *tip = g_strdup_printf("%d rays", sweep->nrays);
+			gtk_widget_set_tooltip_text(button, tip);
+			gtk_widget_set_sensitive(button, FALSE);
+			g_free(tip);
+			continue;
 		}
+		g_object_set_data(G_OBJECT(button), "level2", level2);
+		g_object_set_data(G_OBJECT(button), "type", (gpointer)(guintptr)type);
+		g_object_set_data(G_OBJECT(button), "elev", (gpointer)(guintptr)(elev*100));
+		g_signal_connect(button, "clicked", G_CALLBACK(_on_sweep_clicked), level2);
 	}
 
-	/* Add Iso-surface volume */
+	/* Shove all the buttons to the left */
 	g_object_get(table, "n-columns", &cols, NULL);
-	row_label = gtk_label_new("<b>Isosurface:</b>");
+	gtk_table_attach(GTK_TABLE(table), gtk_label_new(""),
+			cols,cols+1, 0,1, GTK_FILL|GTK_EXPAND,GTK_FILL, 0,0);
+	return table;
+}
+
+GtkWidget *aweather_level2_get_config(AWeatherLevel2 *level2)
+{
+	Wsr88dVolume *radar = level2->radar;
+	g_debug("AWeatherLevel2: get_config - %p, %p", level2, radar);
+	GtkWidget *table = _get_config_table(radar, level2);
+
+	/* Add Iso-surface volume, spanning everything but the row labels */
+	guint rows, cols;
+	g_object_get(table, "n-rows", &rows, "n-columns", &cols, NULL);
+	GtkWidget *row_label = gtk_label_new("<b>Isosurface:</b>");
 	gtk_label_set_use_markup(GTK_LABEL(row_label), TRUE);
 	gtk_misc_set_alignment(GTK_MISC(row_label), 1, 0.5);
 	gtk_table_attach(GTK_TABLE(table), row_label,
@@ -495,39 +1416,87 @@ GtkWidget *aweather_level2_get_config(AWeatherLevel2 *level2)
 	gtk_range_set_inverted(GTK_RANGE(scale), TRUE);
 	gtk_range_set_value(GTK_RANGE(scale), ISO_MAX);
 	g_signal_connect(scale, "value-changed", G_CALLBACK(_on_iso_changed), level2);
-	gtk_table_attach(GTK_TABLE(table), scale,
-			1,cols+1, rows,rows+1, GTK_FILL|GTK_EXPAND,GTK_FILL, 0,0);
-	/* Shove all the buttons to the left, but keep the slider expanded */
-	gtk_table_attach(GTK_TABLE(table), gtk_label_new(""),
-			cols,cols+1, 0,1, GTK_FILL|GTK_EXPAND,GTK_FILL, 0,0);
+	GtkWidget *shells = gtk_check_button_new_with_label("Shells");
+	gtk_widget_set_tooltip_text(shells, "Show the 30, 45 and 60 dBZ levels together");
+	g_object_set_data(G_OBJECT(shells), "scale", scale);
+	g_signal_connect(shells, "toggled", G_CALLBACK(_on_shells_toggled), level2);
+	GtkWidget *hbox = gtk_hbox_new(FALSE, 5);
+	gtk_box_pack_start(GTK_BOX(hbox), scale,  TRUE,  TRUE,  0);
+	gtk_box_pack_start(GTK_BOX(hbox), shells, FALSE, FALSE, 0);
+	gtk_table_attach(GTK_TABLE(table), hbox,
+			1,cols, rows,rows+1, GTK_FILL|GTK_EXPAND,GTK_FILL, 0,0);
 	return table;
 }
 
+Wsr88dVolume *aweather_level2_stream_scan(AWeatherLevel2Stream *stream)
+{
+	Wsr88dVolume *scan = wsr88d_volume_scan(stream->radar);
+	if (scan->nsweeps <= stream->shown) {
+		wsr88d_volume_free(scan);
+		return NULL;
+	}
+	g_debug("AWeatherLevel2: stream_scan - %d sweeps, vcp %d",
+			scan->nsweeps, scan->vcp);
+	stream->shown = scan->nsweeps;
+	return scan;
+}
+
+GtkWidget *aweather_level2_get_scan_config(Wsr88dVolume *scan)
+{
+	return _get_config_table(scan, NULL);
+}
+
 /****************
  * GObject code *
  ****************/
 G_DEFINE_TYPE(AWeatherLevel2, aweather_level2, GRITS_TYPE_OBJECT);
 static void aweather_level2_init(AWeatherLevel2 *level2)
 {
+	level2->sweep_pool = g_thread_pool_new(_sweep_job, NULL, 1, FALSE, NULL);
+	g_thread_pool_set_sort_function(level2->sweep_pool, _sweep_job_sort, NULL);
+	level2->iso_pool   = g_thread_pool_new(_iso_job, NULL, 1, FALSE, NULL);
+	level2->iso_cache  = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, _iso_free);
 }
+/* Sweep jobs hold a reference, so this is run when the level2 is removed
+ * to stop loading sweeps nobody will see. Queued jobs are dropped as they
+ * come up and nothing else is prefetched. */
 static void aweather_level2_dispose(GObject *_level2)
 {
 	AWeatherLevel2 *level2 = AWEATHER_LEVEL2(_level2);
 	g_debug("AWeatherLevel2: dispose - %p", _level2);
-	if (level2->volume) {
-		grits_viewer_remove(GRITS_OBJECT(level2->volume)->viewer,
-				GRITS_OBJECT(level2->volume));
-		level2->volume = NULL;
-	}
+	g_atomic_int_set(&level2->disposed, TRUE);
 	G_OBJECT_CLASS(aweather_level2_parent_class)->dispose(_level2);
 }
 static void aweather_level2_finalize(GObject *_level2)
 {
 	AWeatherLevel2 *level2 = AWEATHER_LEVEL2(_level2);
 	g_debug("AWeatherLevel2: finalize - %p", _level2);
-	RSL_free_radar(level2->radar);
-	if (level2->sweep_tex)
-		glDeleteTextures(1, &level2->sweep_tex);
+	g_thread_pool_free(level2->sweep_pool, FALSE, TRUE);
+	g_thread_pool_free(level2->iso_pool,   FALSE, TRUE);
+	GHashTableIter iter;
+	AWeatherLevel2Iso *iso;
+	g_hash_table_iter_init(&iter, level2->iso_cache);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&iso))
+		radar_texture_untrack(iso->use);
+	g_hash_table_destroy(level2->iso_cache);
+	if (level2->iso_preview)
+		_iso_free(level2->iso_preview);
+	radar_texture_untrack(level2->iso_grid_use);
+	radar_iso_grid_unref(level2->iso_grid);
+	radar_iso_grid_unref(level2->iso_coarse);
+	for (guint si = 0; level2->radar && si < level2->radar->nsweeps; si++) {
+		radar_texture_untrack(level2->sweep_uses[si]);
+		_free_sweep_gl(level2, si);
+	}
+	if (level2->sweep_pal)
+		glDeleteTextures(1, &level2->sweep_pal);
+	wsr88d_volume_free(level2->radar);
+	g_free(level2->cache);
+	g_free(level2->sweep_texs);
+	g_free(level2->sweep_vbos);
+	g_free(level2->sweep_meshes);
+	g_free(level2->sweep_uses);
 	G_OBJECT_CLASS(aweather_level2_parent_class)->finalize(_level2);
 }
 static void aweather_level2_class_init(AWeatherLevel2Class *klass)
@@ -535,5 +1504,4 @@ static void aweather_level2_class_init(AWeatherLevel2Class *klass)
 	G_OBJECT_CLASS(klass)->dispose  = aweather_level2_dispose;
 	G_OBJECT_CLASS(klass)->finalize = aweather_level2_finalize;
 	GRITS_OBJECT_CLASS(klass)->draw = aweather_level2_draw;
-	GRITS_OBJECT_CLASS(klass)->hide = aweather_level2_hide;
 }
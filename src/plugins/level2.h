@@ -20,6 +20,8 @@
 
 #include <grits.h>
 #include "radar-info.h"
+#include "radar-texture.h"
+#include "radar-iso.h"
 
 /* Level2 */
 #define AWEATHER_TYPE_LEVEL2            (aweather_level2_get_type())
@@ -31,18 +33,39 @@
 
 typedef struct _AWeatherLevel2      AWeatherLevel2;
 typedef struct _AWeatherLevel2Class AWeatherLevel2Class;
+typedef struct _AWeatherLevel2Iso   AWeatherLevel2Iso;
 
 struct _AWeatherLevel2 {
 	GritsObject       parent;
-	Radar            *radar;
+	Wsr88dVolume     *radar;
 	AWeatherColormap *colormap;
+	gdouble           iso_resolution; // Isosurface grid spacing (m)
 
 	/* Private */
-	GritsVolume      *volume;
-	Sweep            *sweep;
+	gfloat            iso;             // Last level from set_iso
+	gboolean          iso_shells;      // Show nested levels instead of iso
+	AWeatherLevel2Iso *iso_shown;
+	gboolean          iso_evicted;     // Shown surface was freed, reload it
+	gboolean          iso_busy;        // Extraction running in iso_pool
+	GThreadPool      *iso_pool;
+	GHashTable       *iso_cache;       // Surfaces by level
+	AWeatherLevel2Iso *iso_preview;    // Coarse surface shown until ready
+	RadarIsoGrid     *iso_grid;
+	RadarIsoGrid     *iso_coarse;      // Grid for previews
+	RadarTextureUse  *iso_grid_use;
+	Wsr88dSweep      *sweep;
 	AWeatherColormap *sweep_colors;
-	gdouble           sweep_coords[2];
-	guint             sweep_tex;
+	guint             sweep_si;        // Index of the sweep being shown
+	gboolean          sweep_evicted;   // Shown sweep was freed, reload it
+	guint            *sweep_texs;      // One texture per sweep, 0 until loaded
+	guint            *sweep_vbos;      // Vertex buffer for each sweep mesh
+	gfloat          **sweep_meshes;    // Texture coords and vertices
+	RadarTextureUse **sweep_uses;      // Budget handle for each sweep
+	guint             sweep_pal;       // Colors for the codes in sweep_texs
+	GThreadPool      *sweep_pool; // Converts sweeps for set_sweep
+	gint              sweep_serial;
+	gint              disposed;   // Removed, stop loading sweeps
+	gchar            *cache;      // Saved here once everything is decoded
 };
 
 struct _AWeatherLevel2Class {
@@ -51,16 +74,37 @@ struct _AWeatherLevel2Class {
 
 GType aweather_level2_get_type(void);
 
-AWeatherLevel2 *aweather_level2_new(Radar *radar, AWeatherColormap *colormap);
+AWeatherLevel2 *aweather_level2_new(Wsr88dVolume *radar, AWeatherColormap *colormap);
 
 AWeatherLevel2 *aweather_level2_new_from_file(const gchar *file, const gchar *site,
 		AWeatherColormap *colormap);
 
+/* Load a volume while it is still downloading. Call update as the file
+ * grows and finish once it is complete, or with a NULL file to abort. */
+typedef struct _AWeatherLevel2Stream AWeatherLevel2Stream;
+
+AWeatherLevel2Stream *aweather_level2_stream_new(const gchar *site);
+
+void aweather_level2_stream_update(AWeatherLevel2Stream *stream, const gchar *file);
+
+/* Copy of the part of the volume decoded so far, or NULL if no sweeps have
+ * been found since the last call. Call it from the thread feeding the
+ * stream and free the copy with wsr88d_volume_free. */
+Wsr88dVolume *aweather_level2_stream_scan(AWeatherLevel2Stream *stream);
+
+/* Sweep table for a scan from stream_scan, with the buttons disabled */
+GtkWidget *aweather_level2_get_scan_config(Wsr88dVolume *scan);
+
+AWeatherLevel2 *aweather_level2_stream_finish(AWeatherLevel2Stream *stream,
+		const gchar *file, AWeatherColormap *colormap);
+
 void aweather_level2_set_sweep(AWeatherLevel2 *level2,
 		int type, gfloat elev);
 
 void aweather_level2_set_iso(AWeatherLevel2 *level2, gfloat level);
 
+void aweather_level2_set_iso_shells(AWeatherLevel2 *level2, gboolean shells);
+
 GtkWidget *aweather_level2_get_config(AWeatherLevel2 *level2);
 
 #endif
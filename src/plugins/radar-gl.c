@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <grits.h>
+
+#if defined(G_OS_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dlfcn.h>
+#else
+#include <GL/glx.h>
+#endif
+
+#include "radar-gl.h"
+
+RadarGL radar_gl;
+
+typedef struct {
+	glong        offset;  // Of the function pointer in RadarGL
+	const gchar *name;
+} RadarGLProc;
+
+#define PROC(func) { G_STRUCT_OFFSET(RadarGL, func), "gl" #func }
+
+static gpointer _gl_proc(const gchar *name)
+{
+#if defined(G_OS_WIN32)
+	/* Some drivers return small numbers instead of NULL on failure */
+	gpointer proc = (gpointer)wglGetProcAddress(name);
+	if ((gsize)proc <= 3 || proc == (gpointer)-1)
+		return NULL;
+	return proc;
+#elif defined(__APPLE__)
+	return dlsym(RTLD_DEFAULT, name);
+#else
+	return (gpointer)glXGetProcAddressARB((const GLubyte*)name);
+#endif
+}
+
+/* Look up every function in procs, FALSE if any are missing */
+static gboolean _gl_load(const RadarGLProc *procs, gint nprocs)
+{
+	for (int i = 0; i < nprocs; i++) {
+		gpointer proc = _gl_proc(procs[i].name);
+		if (!proc) {
+			g_debug("RadarGL: load - missing %s", procs[i].name);
+			return FALSE;
+		}
+		G_STRUCT_MEMBER(gpointer, &radar_gl, procs[i].offset) = proc;
+	}
+	return TRUE;
+}
+
+gboolean radar_gl_version(gint major, gint minor)
+{
+	const gchar *version = (const gchar*)glGetString(GL_VERSION);
+	gint have_major = 0, have_minor = 0;
+	if (version)
+		sscanf(version, "%d.%d", &have_major, &have_minor);
+	return have_major > major ||
+	      (have_major == major && have_minor >= minor);
+}
+
+gboolean radar_gl_buffers(void)
+{
+	static gint buffers; // 0 not checked yet, 1 supported, -1 unsupported
+	if (!buffers) {
+		buffers = -1;
+#ifdef GL_VERSION_1_5
+		static const RadarGLProc procs[] = {
+			PROC(GenBuffers),
+			PROC(DeleteBuffers),
+			PROC(BindBuffer),
+			PROC(BufferData),
+			PROC(MapBuffer),
+			PROC(UnmapBuffer),
+		};
+		if (radar_gl_version(1, 5) && _gl_load(procs, G_N_ELEMENTS(procs)))
+			buffers = 1;
+#endif
+		g_debug("RadarGL: buffers - %s", buffers > 0 ? "yes" : "no");
+	}
+	return buffers > 0;
+}
+
+gboolean radar_gl_shaders(void)
+{
+	static gint shaders; // 0 not checked yet, 1 supported, -1 unsupported
+	if (!shaders) {
+		shaders = -1;
+#ifdef GL_VERSION_2_0
+		static const RadarGLProc procs[] = {
+			PROC(ActiveTexture),
+			PROC(CreateShader),
+			PROC(ShaderSource),
+			PROC(CompileShader),
+			PROC(DeleteShader),
+			PROC(CreateProgram),
+			PROC(AttachShader),
+			PROC(LinkProgram),
+			PROC(GetProgramiv),
+			PROC(GetProgramInfoLog),
+			PROC(DeleteProgram),
+			PROC(UseProgram),
+			PROC(GetUniformLocation),
+			PROC(Uniform1i),
+		};
+		if (radar_gl_version(2, 0) && _gl_load(procs, G_N_ELEMENTS(procs)))
+			shaders = 1;
+#endif
+		g_debug("RadarGL: shaders - %s", shaders > 0 ? "yes" : "no");
+	}
+	return shaders > 0;
+}
+
+/* Each gate code is looked up in a 256 texel palette built with
+ * colormap_sweep_lut, the code c is read as c/255 */
+static const gchar *palette_shader =
+	"uniform sampler2D codes;\n"
+	"uniform sampler1D palette;\n"
+	"void main() {\n"
+	"	float code = texture2D(codes, gl_TexCoord[0].st).r;\n"
+	"	gl_FragColor = texture1D(palette, (code*255.0+0.5)/256.0) * gl_Color;\n"
+	"}\n";
+
+GLuint radar_gl_palette_program(void)
+{
+#ifdef GL_VERSION_2_0
+	if (!radar_gl_shaders())
+		return 0;
+	GLint  ok = 0;
+	GLuint shader  = radar_gl.CreateShader(GL_FRAGMENT_SHADER);
+	GLuint program = radar_gl.CreateProgram();
+	radar_gl.ShaderSource(shader, 1, &palette_shader, NULL);
+	radar_gl.CompileShader(shader);
+	radar_gl.AttachShader(program, shader);
+	radar_gl.LinkProgram(program);
+	radar_gl.DeleteShader(shader);
+	radar_gl.GetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		gchar log[1024] = "";
+		radar_gl.GetProgramInfoLog(program, sizeof(log), NULL, log);
+		g_warning("RadarGL: palette_program - %s", log);
+		radar_gl.DeleteProgram(program);
+		return 0;
+	}
+	radar_gl.UseProgram(program);
+	radar_gl.Uniform1i(radar_gl.GetUniformLocation(program, "codes"),   0);
+	radar_gl.Uniform1i(radar_gl.GetUniformLocation(program, "palette"), 1);
+	radar_gl.UseProgram(0);
+	return program;
+#else
+	return 0;
+#endif
+}
+
+void radar_gl_load_palette(GLuint *tex, const guint32 lut[256])
+{
+	if (!*tex)
+		glGenTextures(1, tex);
+	glBindTexture(GL_TEXTURE_1D, *tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, 256, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, lut);
+	glTexParameterf(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameterf(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_1D, 0);
+}
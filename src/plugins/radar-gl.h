@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RADAR_GL_H__
+#define __RADAR_GL_H__
+
+#include <grits.h>
+#ifndef __APPLE__
+#include <GL/glext.h>
+#endif
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+/* OpenGL functions newer than 1.1. These are looked up when the driver is
+ * probed instead of being linked, opengl32 on Windows only exports 1.1.
+ * Each group is only set once its probe below has returned TRUE, and the
+ * probes must be called with the GL context current. */
+typedef struct {
+#ifdef GL_VERSION_1_5
+	void      (APIENTRY *GenBuffers)(GLsizei n, GLuint *buffers);
+	void      (APIENTRY *DeleteBuffers)(GLsizei n, const GLuint *buffers);
+	void      (APIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+	void      (APIENTRY *BufferData)(GLenum target, GLsizeiptr size,
+	                                 const GLvoid *data, GLenum usage);
+	GLvoid   *(APIENTRY *MapBuffer)(GLenum target, GLenum access);
+	GLboolean (APIENTRY *UnmapBuffer)(GLenum target);
+#endif
+#ifdef GL_VERSION_2_0
+	void      (APIENTRY *ActiveTexture)(GLenum texture);
+	GLuint    (APIENTRY *CreateShader)(GLenum type);
+	void      (APIENTRY *ShaderSource)(GLuint shader, GLsizei count,
+	                                   const GLchar **string, const GLint *length);
+	void      (APIENTRY *CompileShader)(GLuint shader);
+	void      (APIENTRY *DeleteShader)(GLuint shader);
+	GLuint    (APIENTRY *CreateProgram)(void);
+	void      (APIENTRY *AttachShader)(GLuint program, GLuint shader);
+	void      (APIENTRY *LinkProgram)(GLuint program);
+	void      (APIENTRY *GetProgramiv)(GLuint program, GLenum pname, GLint *params);
+	void      (APIENTRY *GetProgramInfoLog)(GLuint program, GLsizei size,
+	                                        GLsizei *length, GLchar *log);
+	void      (APIENTRY *DeleteProgram)(GLuint program);
+	void      (APIENTRY *UseProgram)(GLuint program);
+	GLint     (APIENTRY *GetUniformLocation)(GLuint program, const GLchar *name);
+	void      (APIENTRY *Uniform1i)(GLint location, GLint v0);
+#endif
+} RadarGL;
+
+extern RadarGL radar_gl;
+
+/* Whether the driver has OpenGL 1.5 buffer objects */
+gboolean radar_gl_buffers(void);
+
+/* Whether the driver has OpenGL 2.0 shaders and multitexturing */
+gboolean radar_gl_shaders(void);
+
+/* Whether the driver is at least OpenGL major.minor */
+gboolean radar_gl_version(gint major, gint minor);
+
+/* Program which colors the 8 bit gate codes in texture unit 0 with the 256
+ * texel palette in unit 1. Returns 0 if shaders aren't supported or it
+ * failed to compile. */
+GLuint radar_gl_palette_program(void);
+
+/* Load the color for each gate code into a 1D texture for the palette
+ * program, the texture is created if *tex is 0 */
+void radar_gl_load_palette(GLuint *tex, const guint32 lut[256]);
+
+#endif
@@ -15,16 +15,139 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <rsl.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLORMAP_X86
+#include <immintrin.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
 #include "radar-info.h"
 
 AWeatherColormap colormaps[] = {
-	// type    file      ...
-	{DZ_INDEX, "dz.clr"},
-	{VR_INDEX, "vr.clr"},
-	{SW_INDEX, "sw.clr"},
-	{DR_INDEX, "dr.clr"},
-	{PH_INDEX, "ph.clr"},
-	{RH_INDEX, "rh.clr"},
-	{0,        NULL    },
+	// type      file      ...
+	{WSR88D_REF, "dz.clr"},
+	{WSR88D_VEL, "vr.clr"},
+	{WSR88D_SW,  "sw.clr"},
+	{WSR88D_ZDR, "dr.clr"},
+	{WSR88D_PHI, "ph.clr"},
+	{WSR88D_RHO, "rh.clr"},
+	{0,          NULL    },
 };
+
+void colormap_load(const gchar *filename, AWeatherColormap *cm)
+{
+	g_debug("RadarInfo: colormap_load - %s", filename);
+	FILE *file = fopen(filename, "r");
+	if (!file)
+		g_error("RadarInfo: colormap_load - open failed");
+	guint8 color[4];
+	GArray *array = g_array_sized_new(FALSE, TRUE, sizeof(color), 256);
+	if (!fgets(cm->name, sizeof(cm->name), file)) goto out;
+	if (!fscanf(file, "%f\n", &cm->scale))        goto out;
+	if (!fscanf(file, "%f\n", &cm->shift))        goto out;
+	int r, g, b, a;
+	while (fscanf(file, "%d %d %d %d\n", &r, &g, &b, &a) == 4) {
+		color[0] = r;
+		color[1] = g;
+		color[2] = b;
+		color[3] = a;
+		g_array_append_val(array, color);
+	}
+	cm->len  = (gint )array->len;
+	cm->data = (void*)array->data;
+out:
+	g_array_free(array, FALSE);
+	fclose(file);
+}
+
+void colormap_sweep_lut(AWeatherColormap *colormap, Wsr88dSweep *sweep,
+		guint32 lut[256])
+{
+	for (guint code = 0; code < 256; code++) {
+		guint8 color[4] = {};
+		if (code != WSR88D_BELOW_THRESHOLD &&
+		    code != WSR88D_RANGE_FOLDED) {
+			guint8 *data = colormap_get(colormap,
+					wsr88d_sweep_value(sweep, code));
+			color[0] = data[0];
+			color[1] = data[1];
+			color[2] = data[2];
+			color[3] = data[3]*0.75; // TESTING
+		}
+		memcpy(&lut[code], color, 4);
+	}
+}
+
+/* Gate code lookups. Most gates are below threshold, so the vector versions
+ * fill runs of sixteen code 0 gates at once. SSE2 has no gather, so it only
+ * speeds up those runs and looks up the rest one gate at a time, AVX2
+ * gathers them eight at a time. */
+static void _colormap_lookup_scalar(const guint32 *lut, const guint8 *codes,
+		guint32 *rgba, gsize n)
+{
+	for (gsize i = 0; i < n; i++)
+		rgba[i] = lut[codes[i]];
+}
+
+#ifdef COLORMAP_X86
+__attribute__((target("sse2")))
+static void _colormap_lookup_sse2(const guint32 *lut, const guint8 *codes,
+		guint32 *rgba, gsize n)
+{
+	__m128i zero  = _mm_setzero_si128();
+	__m128i empty = _mm_set1_epi32(lut[0]);
+	gsize i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i*)(codes+i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)) == 0xffff) {
+			_mm_storeu_si128((__m128i*)(rgba+i+ 0), empty);
+			_mm_storeu_si128((__m128i*)(rgba+i+ 4), empty);
+			_mm_storeu_si128((__m128i*)(rgba+i+ 8), empty);
+			_mm_storeu_si128((__m128i*)(rgba+i+12), empty);
+		} else {
+			for (gsize j = i; j < i+16; j++)
+				rgba[j] = lut[codes[j]];
+		}
+	}
+	_colormap_lookup_scalar(lut, codes+i, rgba+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void _colormap_lookup_avx2(const guint32 *lut, const guint8 *codes,
+		guint32 *rgba, gsize n)
+{
+	__m128i zero  = _mm_setzero_si128();
+	__m256i empty = _mm256_set1_epi32(lut[0]);
+	gsize i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i*)(codes+i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)) == 0xffff) {
+			_mm256_storeu_si256((__m256i*)(rgba+i+0), empty);
+			_mm256_storeu_si256((__m256i*)(rgba+i+8), empty);
+		} else {
+			__m256i lo = _mm256_cvtepu8_epi32(c);
+			__m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(c, 8));
+			_mm256_storeu_si256((__m256i*)(rgba+i+0),
+				_mm256_i32gather_epi32((const int*)lut, lo, 4));
+			_mm256_storeu_si256((__m256i*)(rgba+i+8),
+				_mm256_i32gather_epi32((const int*)lut, hi, 4));
+		}
+	}
+	_colormap_lookup_scalar(lut, codes+i, rgba+i, n-i);
+}
+#endif
+
+void colormap_lookup(const guint32 lut[256], const guint8 *codes,
+		guint32 *rgba, gsize n)
+{
+#ifdef COLORMAP_X86
+	if (__builtin_cpu_supports("avx2"))
+		_colormap_lookup_avx2(lut, codes, rgba, n);
+	else if (__builtin_cpu_supports("sse2"))
+		_colormap_lookup_sse2(lut, codes, rgba, n);
+	else
+#endif
+		_colormap_lookup_scalar(lut, codes, rgba, n);
+}
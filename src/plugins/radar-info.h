@@ -19,10 +19,11 @@
 #define __AWEATHER_COLORMAP_H__
 
 #include <glib.h>
-#include <rsl.h>
+
+#include "../wsr88d-decode.h"
 
 typedef struct {
-	gint     type;     // From RSL e.g. DZ_INDEX
+	gint     type;     // Moment, e.g. WSR88D_REF
 	gchar   *file;     // Basename of the colors file
 	gchar    name[64]; // Name of the colormap          (line 1)
 	gfloat   scale;    // Map values to color table idx (line 2)
@@ -36,7 +37,22 @@ extern AWeatherColormap colormaps[];
 static inline guint8 *colormap_get(AWeatherColormap *colormap, float value)
 {
 	int idx = value * colormap->scale + colormap->shift;
-	return colormap->data[CLAMP(idx, 0, colormap->len)];
+	return colormap->data[CLAMP(idx, 0, colormap->len-1)];
 }
 
+/* Read a colors file into cm, the type and file are left alone */
+void colormap_load(const gchar *filename, AWeatherColormap *cm);
+
+/* Colors for every gate code in a sweep. The codes are only 8 bits, so
+ * this replaces converting and looking up each gate. The table depends on
+ * the scale and offset of the sweep, not just the moment, so it's built for
+ * each sweep, which is only 256 lookups. */
+void colormap_sweep_lut(AWeatherColormap *colormap, Wsr88dSweep *sweep,
+		guint32 lut[256]);
+
+/* Convert `n' gate codes to colors using a table built for the sweep,
+ * with SSE2 or AVX2 if the CPU supports them */
+void colormap_lookup(const guint32 lut[256], const guint8 *codes,
+		guint32 *rgba, gsize n);
+
 #endif
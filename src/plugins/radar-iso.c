@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <math.h>
+#include <string.h>
+#include <grits.h>
+
+#include "radar-iso.h"
+
+/* Each cube of 8 grid points is split into 6 tetrahedra around the
+ * diagonal from corner 0 to corner 6 */
+static const gint iso_corners[8][3] = {
+	{0,0,0}, {1,0,0}, {1,1,0}, {0,1,0},
+	{0,0,1}, {1,0,1}, {1,1,1}, {0,1,1},
+};
+
+static const gint iso_tets[6][4] = {
+	{0,6,1,2}, {0,6,2,3}, {0,6,3,7},
+	{0,6,7,4}, {0,6,4,5}, {0,6,5,1},
+};
+
+static inline gfloat _iso_value(RadarIsoGrid *grid, gint x, gint y, gint z)
+{
+	x = CLAMP(x, 0, grid->xs-1);
+	y = CLAMP(y, 0, grid->ys-1);
+	z = CLAMP(z, 0, grid->zs-1);
+	return radar_iso_grid_get(grid, x, y, z);
+}
+
+/************
+ * Grid     *
+ ************/
+RadarIsoGrid *radar_iso_grid_new(gint xs, gint ys, gint zs, gdouble res)
+{
+	RadarIsoGrid *grid = g_new0(RadarIsoGrid, 1);
+	grid->xs   = xs;
+	grid->ys   = ys;
+	grid->zs   = zs;
+	grid->res  = res;
+	grid->refs = 1;
+	grid->pxs  = (xs + RADAR_ISO_BLOCK-1) / RADAR_ISO_BLOCK;
+	grid->pys  = (ys + RADAR_ISO_BLOCK-1) / RADAR_ISO_BLOCK;
+	grid->pzs  = (zs + RADAR_ISO_BLOCK-1) / RADAR_ISO_BLOCK;
+	grid->data = g_malloc0((gsize)grid->pxs*grid->pys*grid->pzs *
+			RADAR_ISO_BLOCK*RADAR_ISO_BLOCK*RADAR_ISO_BLOCK);
+	grid->bxs  = MAX(xs-1 + RADAR_ISO_BLOCK-1, 0) / RADAR_ISO_BLOCK;
+	grid->bys  = MAX(ys-1 + RADAR_ISO_BLOCK-1, 0) / RADAR_ISO_BLOCK;
+	grid->bzs  = MAX(zs-1 + RADAR_ISO_BLOCK-1, 0) / RADAR_ISO_BLOCK;
+	gint nblocks = grid->bxs * grid->bys * grid->bzs;
+	grid->min  = g_new(gfloat, nblocks);
+	grid->max  = g_new(gfloat, nblocks);
+	return grid;
+}
+
+void radar_iso_grid_finish(RadarIsoGrid *grid)
+{
+	/* Blocks include the points on their far sides, which are shared
+	 * with the next block */
+	gint bi = 0;
+	for (gint bz = 0; bz < grid->bzs; bz++)
+	for (gint by = 0; by < grid->bys; by++)
+	for (gint bx = 0; bx < grid->bxs; bx++, bi++) {
+		gfloat min = INFINITY, max = -INFINITY;
+		for (gint z = bz*RADAR_ISO_BLOCK; z <= MIN((bz+1)*RADAR_ISO_BLOCK, grid->zs-1); z++)
+		for (gint y = by*RADAR_ISO_BLOCK; y <= MIN((by+1)*RADAR_ISO_BLOCK, grid->ys-1); y++)
+		for (gint x = bx*RADAR_ISO_BLOCK; x <= MIN((bx+1)*RADAR_ISO_BLOCK, grid->xs-1); x++) {
+			gfloat value = radar_iso_grid_get(grid, x, y, z);
+			min = MIN(min, value);
+			max = MAX(max, value);
+		}
+		grid->min[bi] = min;
+		grid->max[bi] = max;
+	}
+}
+
+RadarIsoGrid *radar_iso_grid_ref(RadarIsoGrid *grid)
+{
+	g_atomic_int_inc(&grid->refs);
+	return grid;
+}
+
+void radar_iso_grid_unref(RadarIsoGrid *grid)
+{
+	if (!grid || !g_atomic_int_dec_and_test(&grid->refs))
+		return;
+	g_free(grid->data);
+	g_free(grid->min);
+	g_free(grid->max);
+	g_free(grid);
+}
+
+gsize radar_iso_grid_size(RadarIsoGrid *grid)
+{
+	return (gsize)grid->pxs*grid->pys*grid->pzs *
+		RADAR_ISO_BLOCK*RADAR_ISO_BLOCK*RADAR_ISO_BLOCK +
+		(gsize)grid->bxs*grid->bys*grid->bzs*2*sizeof(gfloat);
+}
+
+/************
+ * Surfaces *
+ ************/
+/* Every tetrahedron edge runs from a grid point towards +x, +y and/or +z,
+ * so an edge is a point and a direction with a bit for each axis. Points
+ * are numbered within the block, which includes its far sides. */
+#define ISO_POINTS (RADAR_ISO_BLOCK+1)
+
+/* Vertices are shared by every cell around an edge. Edges inside a block
+ * are looked up in edges, which is cleared for each block, and edges on
+ * the faces between blocks are kept in shared for the whole grid. */
+typedef struct {
+	GArray     *verts;    // Position and normal of each vertex
+	GArray     *indices;  // Three vertices for each triangle
+	guint      *edges;    // Vertex index plus one, 0 if not found yet
+	GHashTable *shared;   // Same, by edge in the whole grid
+} IsoLevel;
+
+typedef struct {
+	RadarIsoGrid *grid;
+	gfloat   level;
+	gint     x, y, z;     // Corner 0 of the current cell
+	gint     bx, by, bz;  // Corner 0 of the current block
+	gfloat   values[8];
+	gfloat   grads[8][3]; // Gradient at each corner, once it's needed
+	guint    have;        // Bit for each corner with its gradient set
+	IsoLevel *out;
+} IsoCell;
+
+static const gfloat *_iso_grad(IsoCell *cell, gint corner)
+{
+	gfloat *grad = cell->grads[corner];
+	if (cell->have & (1 << corner))
+		return grad;
+	gint x = cell->x + iso_corners[corner][0];
+	gint y = cell->y + iso_corners[corner][1];
+	gint z = cell->z + iso_corners[corner][2];
+	grad[0] = _iso_value(cell->grid, x+1, y, z) - _iso_value(cell->grid, x-1, y, z);
+	grad[1] = _iso_value(cell->grid, x, y+1, z) - _iso_value(cell->grid, x, y-1, z);
+	grad[2] = _iso_value(cell->grid, x, y, z+1) - _iso_value(cell->grid, x, y, z-1);
+	cell->have |= 1 << corner;
+	return grad;
+}
+
+/* Find the slot for the vertex on the edge from corner a towards b */
+static guint *_iso_edge(IsoCell *cell, gint a, gint b, gsize *key)
+{
+	gint p[3], l[3], dir = 0;
+	gboolean face = FALSE;
+	for (int i = 0; i < 3; i++) {
+		p[i] = iso_corners[a][i];
+		dir |= (iso_corners[b][i] - p[i]) << i;
+	}
+	p[0] += cell->x; l[0] = p[0] - cell->bx;
+	p[1] += cell->y; l[1] = p[1] - cell->by;
+	p[2] += cell->z; l[2] = p[2] - cell->bz;
+	for (int i = 0; i < 3; i++)
+		if (!(dir & (1 << i)) && (l[i] == 0 || l[i] == RADAR_ISO_BLOCK))
+			face = TRUE;
+	if (face) {
+		*key = (((gsize)p[2]*cell->grid->ys + p[1])*cell->grid->xs + p[0])*8 + dir;
+		return NULL;
+	}
+	return &cell->out->edges[((l[2]*ISO_POINTS + l[1])*ISO_POINTS + l[0])*8 + dir];
+}
+
+/* Add the point where the surface crosses the edge between two corners,
+ * the normal points away from the higher values. Each point is only worked
+ * out once and then shared by every triangle using that edge. */
+static void _iso_vertex(IsoCell *cell, gint a, gint b)
+{
+	if (iso_corners[a][0] > iso_corners[b][0] ||
+	    iso_corners[a][1] > iso_corners[b][1] ||
+	    iso_corners[a][2] > iso_corners[b][2]) {
+		gint tmp = a; a = b; b = tmp;
+	}
+	gsize  key  = 0;
+	guint *slot = _iso_edge(cell, a, b, &key);
+	guint  id   = slot ? *slot : GPOINTER_TO_UINT(
+			g_hash_table_lookup(cell->out->shared, GSIZE_TO_POINTER(key)));
+	if (id) {
+		id--;
+		g_array_append_val(cell->out->indices, id);
+		return;
+	}
+
+	gfloat vert[RADAR_ISO_STRIDE];
+	gfloat va = cell->values[a], vb = cell->values[b];
+	gfloat t  = va == vb ? 0.5 : (cell->level - va) / (vb - va);
+	const gint   *corners[] = {iso_corners[a], iso_corners[b]};
+	const gfloat *grad[]    = {_iso_grad(cell, a), _iso_grad(cell, b)};
+	gfloat pos[2][3];
+	for (int i = 0; i < 2; i++) {
+		pos[i][0] = (cell->x + corners[i][0] - cell->grid->xs/2) * cell->grid->res;
+		pos[i][1] = (cell->y + corners[i][1] - cell->grid->ys/2) * cell->grid->res;
+		pos[i][2] = (cell->z + corners[i][2])                    * cell->grid->res;
+	}
+	gfloat len = 0;
+	for (int i = 0; i < 3; i++) {
+		vert[i]   = pos[0][i]  + t*(pos[1][i]  - pos[0][i]);
+		vert[i+3] = -(grad[0][i] + t*(grad[1][i] - grad[0][i]));
+		len += vert[i+3]*vert[i+3];
+	}
+	len = len > 0 ? sqrtf(len) : 1;
+	for (int i = 3; i < 6; i++)
+		vert[i] /= len;
+
+	id = cell->out->verts->len / RADAR_ISO_STRIDE;
+	g_array_append_vals(cell->out->verts, vert, RADAR_ISO_STRIDE);
+	g_array_append_val(cell->out->indices, id);
+	if (slot)
+		*slot = id+1;
+	else
+		g_hash_table_insert(cell->out->shared,
+				GSIZE_TO_POINTER(key), GUINT_TO_POINTER(id+1));
+}
+
+static void _iso_tet(IsoCell *cell, const gint *tet)
+{
+	gint in[4], out[4], nin = 0, nout = 0;
+	for (int i = 0; i < 4; i++) {
+		if (cell->values[tet[i]] >= cell->level)
+			in[nin++]   = tet[i];
+		else
+			out[nout++] = tet[i];
+	}
+	if (nin == 1) {
+		_iso_vertex(cell, in[0], out[0]);
+		_iso_vertex(cell, in[0], out[1]);
+		_iso_vertex(cell, in[0], out[2]);
+	} else if (nin == 3) {
+		_iso_vertex(cell, out[0], in[0]);
+		_iso_vertex(cell, out[0], in[1]);
+		_iso_vertex(cell, out[0], in[2]);
+	} else if (nin == 2) {
+		_iso_vertex(cell, in[0], out[0]);
+		_iso_vertex(cell, in[0], out[1]);
+		_iso_vertex(cell, in[1], out[1]);
+		_iso_vertex(cell, in[1], out[1]);
+		_iso_vertex(cell, in[1], out[0]);
+		_iso_vertex(cell, in[0], out[0]);
+	}
+}
+
+/* Read the cell once and add its part of each level in active */
+static void _iso_cell(IsoCell *cell, const gfloat *levels, IsoLevel *out,
+		const gint *active, gint nactive)
+{
+	for (int i = 0; i < 8; i++)
+		cell->values[i] = radar_iso_grid_get(cell->grid,
+				cell->x + iso_corners[i][0],
+				cell->y + iso_corners[i][1],
+				cell->z + iso_corners[i][2]);
+	cell->have = 0;
+	for (gint a = 0; a < nactive; a++) {
+		gint l = active[a], nin = 0;
+		for (int i = 0; i < 8; i++)
+			nin += cell->values[i] >= levels[l];
+		if (nin == 0 || nin == 8)
+			continue;
+		cell->level = levels[l];
+		cell->out   = &out[l];
+		for (int i = 0; i < 6; i++)
+			_iso_tet(cell, iso_tets[i]);
+	}
+}
+
+RadarIsoSurface *radar_iso_extract(RadarIsoGrid *grid, gfloat level)
+{
+	RadarIsoSurface *surface;
+	radar_iso_extract_levels(grid, &level, 1, &surface);
+	return surface;
+}
+
+void radar_iso_extract_levels(RadarIsoGrid *grid, const gfloat *levels,
+		gint nlevels, RadarIsoSurface **surfaces)
+{
+	const gsize nedges = ISO_POINTS*ISO_POINTS*ISO_POINTS*8;
+	IsoCell   cell   = {};
+	IsoLevel *out    = g_new0(IsoLevel, nlevels);
+	gint     *active = g_new(gint, nlevels);
+	cell.grid = grid;
+	for (gint l = 0; l < nlevels; l++) {
+		out[l].verts   = g_array_new(FALSE, FALSE, sizeof(gfloat));
+		out[l].indices = g_array_new(FALSE, FALSE, sizeof(guint));
+		out[l].edges   = g_new(guint, nedges);
+		out[l].shared  = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	gint bi = 0, skipped = 0;
+	for (gint bz = 0; bz < grid->bzs; bz++)
+	for (gint by = 0; by < grid->bys; by++)
+	for (gint bx = 0; bx < grid->bxs; bx++, bi++) {
+		gint nactive = 0;
+		for (gint l = 0; l < nlevels; l++)
+			if (grid->min[bi] < levels[l] && levels[l] <= grid->max[bi])
+				active[nactive++] = l;
+		if (nactive == 0) {
+			skipped++;
+			continue;
+		}
+		for (gint a = 0; a < nactive; a++)
+			memset(out[active[a]].edges, 0, nedges*sizeof(guint));
+		cell.bx = bx*RADAR_ISO_BLOCK;
+		cell.by = by*RADAR_ISO_BLOCK;
+		cell.bz = bz*RADAR_ISO_BLOCK;
+		for (cell.z = cell.bz; cell.z < MIN(cell.bz+RADAR_ISO_BLOCK, grid->zs-1); cell.z++)
+		for (cell.y = cell.by; cell.y < MIN(cell.by+RADAR_ISO_BLOCK, grid->ys-1); cell.y++)
+		for (cell.x = cell.bx; cell.x < MIN(cell.bx+RADAR_ISO_BLOCK, grid->xs-1); cell.x++)
+			_iso_cell(&cell, levels, out, active, nactive);
+	}
+
+	for (gint l = 0; l < nlevels; l++) {
+		surfaces[l] = g_new0(RadarIsoSurface, 1);
+		surfaces[l]->level    = levels[l];
+		surfaces[l]->nverts   = out[l].verts->len / RADAR_ISO_STRIDE;
+		surfaces[l]->data     = (gfloat*)g_array_free(out[l].verts, FALSE);
+		surfaces[l]->nindices = out[l].indices->len;
+		surfaces[l]->indices  = (guint*)g_array_free(out[l].indices, FALSE);
+		g_debug("RadarIso: extract - %.1f, %u triangles, %u vertices",
+				levels[l], surfaces[l]->nindices/3, surfaces[l]->nverts);
+		g_free(out[l].edges);
+		g_hash_table_destroy(out[l].shared);
+	}
+	g_debug("RadarIso: extract - %d levels, %d/%d blocks skipped",
+			nlevels, skipped, bi);
+	g_free(out);
+	g_free(active);
+}
+
+gsize radar_iso_surface_size(RadarIsoSurface *surface)
+{
+	return surface->nverts*RADAR_ISO_STRIDE*sizeof(gfloat) +
+		surface->nindices*sizeof(guint);
+}
+
+void radar_iso_surface_free(RadarIsoSurface *surface)
+{
+	if (!surface)
+		return;
+	g_free(surface->data);
+	g_free(surface->indices);
+	g_free(surface);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RADAR_ISO_H__
+#define __RADAR_ISO_H__
+
+#include <math.h>
+#include <grits.h>
+
+/* Isosurfaces of a volume grid, extracted with marching tetrahedra. The
+ * grid is split into blocks of cells and the range of values in each block
+ * is kept so blocks the surface can't pass through are skipped.
+ *
+ * Points are spaced evenly, centered on the radar in x and y and starting
+ * at the ground in z, so their coordinates aren't stored. Values are kept
+ * as one byte in half dBZ steps, the same as the reflectivity data, and
+ * stored in bricks of RADAR_ISO_BLOCK points on a side so the neighbors of
+ * a cell are usually in the same few cache lines. */
+#define RADAR_ISO_BLOCK  8   // Points along each side of a brick
+#define RADAR_ISO_SHIFT  3   // log2(RADAR_ISO_BLOCK)
+#define RADAR_ISO_SCALE  0.5
+#define RADAR_ISO_OFFSET -32.0
+
+typedef struct {
+	gint     xs, ys, zs;     // Number of points along each axis
+	gdouble  res;            // Spacing between points (m)
+	gint     pxs, pys, pzs;  // Number of bricks along each axis
+	guint8  *data;           // Values, brick by brick
+	gint     bxs, bys, bzs;  // Number of blocks along each axis
+	gfloat  *min, *max;      // Range of values in each block
+	gint     refs;
+} RadarIsoGrid;
+
+static inline gsize radar_iso_grid_index(RadarIsoGrid *grid,
+		gint x, gint y, gint z)
+{
+	const gint mask = RADAR_ISO_BLOCK-1;
+	gsize brick = ((gsize)(z >> RADAR_ISO_SHIFT) * grid->pys +
+			(y >> RADAR_ISO_SHIFT)) * grid->pxs + (x >> RADAR_ISO_SHIFT);
+	return (brick << (3*RADAR_ISO_SHIFT)) +
+		(((z & mask) << RADAR_ISO_SHIFT | (y & mask)) << RADAR_ISO_SHIFT | (x & mask));
+}
+
+static inline gfloat radar_iso_grid_get(RadarIsoGrid *grid,
+		gint x, gint y, gint z)
+{
+	return grid->data[radar_iso_grid_index(grid, x, y, z)] * RADAR_ISO_SCALE
+		+ RADAR_ISO_OFFSET;
+}
+
+static inline void radar_iso_grid_set(RadarIsoGrid *grid,
+		gint x, gint y, gint z, gfloat value)
+{
+	gint code = lroundf((value - RADAR_ISO_OFFSET) / RADAR_ISO_SCALE);
+	grid->data[radar_iso_grid_index(grid, x, y, z)] = CLAMP(code, 0, 255);
+}
+
+/* Triangles share the vertices on the edges they have in common */
+typedef struct {
+	gfloat   level;
+	gfloat  *data;           // Position and normal of each vertex
+	guint    nverts;
+	guint   *indices;        // Vertices of each triangle
+	guint    nindices;       // Three for each triangle
+} RadarIsoSurface;
+
+#define RADAR_ISO_STRIDE 6   // Floats for each vertex in data
+
+/* The grid starts out empty, call finish once every value is set */
+RadarIsoGrid *radar_iso_grid_new(gint xs, gint ys, gint zs, gdouble res);
+
+void radar_iso_grid_finish(RadarIsoGrid *grid);
+
+RadarIsoGrid *radar_iso_grid_ref(RadarIsoGrid *grid);
+
+void radar_iso_grid_unref(RadarIsoGrid *grid);
+
+gsize radar_iso_grid_size(RadarIsoGrid *grid);
+
+RadarIsoSurface *radar_iso_extract(RadarIsoGrid *grid, gfloat level);
+
+/* Extract nlevels levels in one pass, each cell is read once for all of
+ * them. Sets one surface in surfaces for each level. Only the walk over the
+ * grid and the corner values and gradients are shared, the crossings and
+ * triangles are still worked out for each level and that is most of the
+ * time, so this is barely faster than extracting the levels one at a time. */
+void radar_iso_extract_levels(RadarIsoGrid *grid, const gfloat *levels,
+		gint nlevels, RadarIsoSurface **surfaces);
+
+gsize radar_iso_surface_size(RadarIsoSurface *surface);
+
+void radar_iso_surface_free(RadarIsoSurface *surface);
+
+#endif
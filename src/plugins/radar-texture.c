@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <grits.h>
+
+#include "radar-texture.h"
+#include "radar-gl.h"
+
+static gint npot;  // 0 not checked yet, 1 supported, -1 unsupported
+
+gboolean radar_texture_npot(void)
+{
+	if (!npot) {
+		const gchar *exts = (const gchar*)glGetString(GL_EXTENSIONS);
+		npot = radar_gl_version(2, 0) ||
+		       (exts && strstr(exts, "GL_ARB_texture_non_power_of_two"))
+		       ? 1 : -1;
+		g_debug("RadarTexture: npot - %s", npot > 0 ? "yes" : "no");
+	}
+	return npot > 0;
+}
+
+static gint _texture_pot(gint size)
+{
+	gint pot = 1;
+	while (pot < size)
+		pot <<= 1;
+	return pot;
+}
+
+gsize radar_texture_size(gint width, gint height, gint bpp,
+		gint *tex_width, gint *tex_height)
+{
+	gint pot_width  = _texture_pot(width);
+	gint pot_height = _texture_pot(height);
+	if (!radar_texture_npot()) {
+		*tex_width  = pot_width;
+		*tex_height = pot_height;
+		return 0;
+	}
+	/* Per texture, textures are sized again every time they are reloaded */
+	gsize saved = ((gsize)pot_width*pot_height - (gsize)width*height) * bpp;
+	g_debug("RadarTexture: size - %dx%d, saved %.1f KB",
+			width, height, saved/1024.0);
+	*tex_width  = width;
+	*tex_height = height;
+	return saved;
+}
+
+static gint    pbo;         // 0 not checked yet, 1 supported, -1 unsupported
+static GLuint  pbo_bufs[2];
+static gboolean pbo_busy[2]; // Mapped for a worker or waiting to upload
+static guint   pbo_next;
+
+struct _RadarTextureBuffer {
+	gint     index;   // In pbo_bufs
+	gsize    size;
+	gpointer data;    // Mapped storage, NULL if none could be mapped
+	gboolean done;    // The main thread has tried to map it
+	GMutex  *mutex;
+	GCond   *cond;
+};
+
+static gboolean _texture_pbo(void)
+{
+	if (!pbo) {
+		pbo = -1;
+#ifdef GL_VERSION_2_1
+		const gchar *exts = (const gchar*)glGetString(GL_EXTENSIONS);
+		if (radar_gl_buffers() && (radar_gl_version(2, 1) ||
+		    (exts && strstr(exts, "GL_ARB_pixel_buffer_object")))) {
+			radar_gl.GenBuffers(2, pbo_bufs);
+			pbo = 1;
+		}
+#endif
+		g_debug("RadarTexture: pbo - %s", pbo > 0 ? "yes" : "no");
+	}
+	return pbo > 0;
+}
+
+static void _texture_buffer_free(RadarTextureBuffer *buf)
+{
+	g_mutex_free(buf->mutex);
+	g_cond_free(buf->cond);
+	g_free(buf);
+}
+
+/* Map whichever pixel buffer isn't in use, starting with the one used least
+ * recently, and wake the worker waiting for it */
+static gboolean _texture_map_cb(gpointer _buf)
+{
+	RadarTextureBuffer *buf = _buf;
+	gpointer data = NULL;
+#ifdef GL_VERSION_2_1
+	for (int i = 0; i < 2 && !data && _texture_pbo(); i++) {
+		guint pi = (pbo_next + i) % 2;
+		if (pbo_busy[pi])
+			continue;
+		radar_gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_bufs[pi]);
+		/* Replace the storage first so mapping it never waits for an
+		 * earlier transfer from this buffer to finish */
+		radar_gl.BufferData(GL_PIXEL_UNPACK_BUFFER, buf->size, NULL,
+				GL_STREAM_DRAW);
+		data = radar_gl.MapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		radar_gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (!data) {
+			g_debug("RadarTexture: map - failed");
+			break;
+		}
+		buf->index   = pi;
+		pbo_busy[pi] = TRUE;
+		pbo_next     = pi + 1;
+	}
+#endif
+	g_mutex_lock(buf->mutex);
+	buf->data = data;
+	buf->done = TRUE;
+	g_cond_signal(buf->cond);
+	g_mutex_unlock(buf->mutex);
+	return FALSE;
+}
+
+RadarTextureBuffer *radar_texture_map(gsize size)
+{
+	RadarTextureBuffer *buf = g_new0(RadarTextureBuffer, 1);
+	buf->size  = size;
+	buf->mutex = g_mutex_new();
+	buf->cond  = g_cond_new();
+	g_idle_add(_texture_map_cb, buf);
+	g_mutex_lock(buf->mutex);
+	while (!buf->done)
+		g_cond_wait(buf->cond, buf->mutex);
+	g_mutex_unlock(buf->mutex);
+	if (!buf->data) {
+		_texture_buffer_free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+gpointer radar_texture_buffer_data(RadarTextureBuffer *buf)
+{
+	return buf->data;
+}
+
+/* Unmap the buffer, it's left bound to GL_PIXEL_UNPACK_BUFFER. Returns
+ * FALSE if the contents were lost while it was mapped. */
+static gboolean _texture_unmap(RadarTextureBuffer *buf)
+{
+	gboolean ok = FALSE;
+#ifdef GL_VERSION_2_1
+	radar_gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_bufs[buf->index]);
+	ok = radar_gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	pbo_busy[buf->index] = FALSE;
+#endif
+	return ok;
+}
+
+void radar_texture_upload_buffer(RadarTextureBuffer *buf, GLenum format,
+		gint x, gint y, gint width, gint height)
+{
+#ifdef GL_VERSION_2_1
+	if (_texture_unmap(buf))
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x,y, width,height,
+				format, GL_UNSIGNED_BYTE, NULL);
+	else
+		g_warning("RadarTexture: upload_buffer - buffer was lost");
+	radar_gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+	_texture_buffer_free(buf);
+}
+
+void radar_texture_unmap(RadarTextureBuffer *buf)
+{
+#ifdef GL_VERSION_2_1
+	_texture_unmap(buf);
+	radar_gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+	_texture_buffer_free(buf);
+}
+
+void radar_texture_upload(GLenum format, gint x, gint y,
+		gint width, gint height, const void *data)
+{
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x,y, width,height,
+			format, GL_UNSIGNED_BYTE, data);
+}
+
+struct _RadarTextureUse {
+	GList            link;    // In budget_lru, most recently drawn first
+	gsize            bytes;
+	gdouble          drawn;   // Time of the last touch
+	RadarTextureFunc evict;
+	gpointer         owner;
+	guint            index;
+};
+
+static gsize   budget = 256*1024*1024;
+static gsize   budget_used;
+static GQueue  budget_lru = G_QUEUE_INIT;
+static GTimer *budget_timer;
+
+static gdouble _budget_now(void)
+{
+	if (!budget_timer)
+		budget_timer = g_timer_new();
+	return g_timer_elapsed(budget_timer, NULL);
+}
+
+static void _budget_evict(void)
+{
+	gdouble now = _budget_now();
+	GList  *link = budget_lru.tail;
+	while (budget_used > budget && link) {
+		GList *prev = link->prev;
+		RadarTextureUse *use = link->data;
+		if (use->evict && now - use->drawn > 1) {
+			g_debug("RadarTexture: evict - %p/%u, %.1f KB",
+					use->owner, use->index, use->bytes/1024.0);
+			g_queue_unlink(&budget_lru, link);
+			budget_used -= use->bytes;
+			use->evict(use->owner, use->index);
+			g_free(use);
+		}
+		link = prev;
+	}
+}
+
+void radar_texture_set_budget(gsize bytes)
+{
+	g_debug("RadarTexture: set_budget - %.1f MB", bytes/(1024.0*1024.0));
+	budget = bytes;
+	_budget_evict();
+}
+
+RadarTextureUse *radar_texture_track(gsize bytes,
+		RadarTextureFunc evict, gpointer owner, guint index)
+{
+	RadarTextureUse *use = g_new0(RadarTextureUse, 1);
+	use->link.data = use;
+	use->bytes     = bytes;
+	use->drawn     = _budget_now();
+	use->evict     = evict;
+	use->owner     = owner;
+	use->index     = index;
+	g_queue_push_head_link(&budget_lru, &use->link);
+	budget_used += bytes;
+	_budget_evict();
+	g_debug("RadarTexture: track - %.1f KB, %.1f/%.1f MB used",
+			bytes/1024.0, budget_used/(1024.0*1024.0),
+			budget/(1024.0*1024.0));
+	return use;
+}
+
+void radar_texture_touch(RadarTextureUse *use)
+{
+	use->drawn = _budget_now();
+	g_queue_unlink(&budget_lru, &use->link);
+	g_queue_push_head_link(&budget_lru, &use->link);
+}
+
+void radar_texture_untrack(RadarTextureUse *use)
+{
+	if (!use)
+		return;
+	g_queue_unlink(&budget_lru, &use->link);
+	budget_used -= use->bytes;
+	g_free(use);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RADAR_TEXTURE_H__
+#define __RADAR_TEXTURE_H__
+
+#include <grits.h>
+
+/* Texture helpers shared by the sweeps and the CONUS tiles. These make GL
+ * calls so they must be called from the main thread, except for
+ * radar_texture_map and radar_texture_buffer_data. */
+
+/* Whether textures can have any size, either from OpenGL 2.0 or from
+ * ARB_texture_non_power_of_two */
+gboolean radar_texture_npot(void);
+
+/* Size of a texture for width x height texels, rounded up to powers of two
+ * when the driver needs it. Returns the bytes saved by not rounding up, at
+ * bpp bytes per texel. */
+gsize radar_texture_size(gint width, gint height, gint bpp,
+		gint *tex_width, gint *tex_height);
+
+/* Upload texels from memory into part of the bound GL_TEXTURE_2D */
+void radar_texture_upload(GLenum format, gint x, gint y,
+		gint width, gint height, const void *data);
+
+/* Pixel buffers let a worker thread write texels straight into memory the
+ * driver can transfer from, so the main thread only has to start the
+ * upload. Two buffers are used in turn, while one is being filled the
+ * other may still be transferring. */
+typedef struct _RadarTextureBuffer RadarTextureBuffer;
+
+/* Get a buffer for size bytes of texels. This is called from a worker and
+ * waits for the main thread to map the buffer, so the main thread must not
+ * be waiting on the worker. Returns NULL when the driver has no pixel
+ * buffers or both are in use, the texels are then uploaded from memory. */
+RadarTextureBuffer *radar_texture_map(gsize size);
+
+/* Where the worker writes the texels */
+gpointer radar_texture_buffer_data(RadarTextureBuffer *buf);
+
+/* Unmap the buffer and upload it into part of the bound GL_TEXTURE_2D, the
+ * buffer is released */
+void radar_texture_upload_buffer(RadarTextureBuffer *buf, GLenum format,
+		gint x, gint y, gint width, gint height);
+
+/* Release a buffer that won't be uploaded */
+void radar_texture_unmap(RadarTextureBuffer *buf);
+
+/* Memory budget for textures and other data that can be rebuilt, shared by
+ * every site. Each allocation is tracked along with a function to evict it,
+ * and when the total goes over the budget the least recently drawn
+ * allocations are evicted. Anything drawn within the last second is kept,
+ * so the budget can be exceeded while everything on screen needs it. */
+typedef struct _RadarTextureUse RadarTextureUse;
+
+/* Free the data for index of owner. The handle is freed after this returns
+ * and must not be untracked. */
+typedef void (*RadarTextureFunc)(gpointer owner, guint index);
+
+void radar_texture_set_budget(gsize bytes);
+
+/* Start tracking bytes, evict is NULL for data that must be kept */
+RadarTextureUse *radar_texture_track(gsize bytes,
+		RadarTextureFunc evict, gpointer owner, guint index);
+
+/* Mark the data as drawn */
+void radar_texture_touch(RadarTextureUse *use);
+
+/* Stop tracking data which was freed by its owner */
+void radar_texture_untrack(RadarTextureUse *use);
+
+#endif
@@ -22,12 +22,12 @@
 #include <gtk/gtk.h>
 #include <gio/gio.h>
 #include <math.h>
-#include <rsl.h>
 
 #include <grits.h>
 
 #include "radar.h"
 #include "level2.h"
+#include "radar-texture.h"
 #include "../aweather-location.h"
 
 static void _gtk_bin_set_child(GtkBin *bin, GtkWidget *new)
@@ -93,6 +93,7 @@ struct _RadarSite {
 	RadarSiteStatus status;      // Loading status for the site
 	GtkWidget      *config;
 	AWeatherLevel2 *level2;      // The Level2 structure for the current volume
+	AWeatherLevel2Stream *stream; // Decoder fed while the volume downloads
 
 	/* Internal data */
 	time_t          time;        // Current timestamp of the level2
@@ -102,12 +103,17 @@ struct _RadarSite {
 	guint           location_id; // "locaiton-changed" callback ID
 };
 
-/* format: http://mesonet.agron.iastate.edu/data/nexrd2/raw/KABR/KABR_20090510_0323 */
-void _site_update_loading(gchar *file, goffset cur,
-		goffset total, gpointer _site)
+/* Download progress and the sweeps found so far, passed from the fetch
+ * thread and shown from the main thread. The scan is a copy, so it stays
+ * valid after the stream is finished and freed. */
+typedef struct {
+	RadarSite    *site;
+	goffset       cur;
+	goffset       total;
+	Wsr88dVolume *scan;    // NULL if nothing new was found
+} RadarSiteProgress;
+static void _set_progress(GtkWidget *progress_bar, goffset cur, goffset total)
 {
-	RadarSite *site = _site;
-	GtkWidget *progress_bar = gtk_bin_get_child(GTK_BIN(site->config));
 	double percent = (double)cur/total;
 	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(progress_bar), MIN(percent, 1.0));
 	gchar *msg = g_strdup_printf("Loading... %5.1f%% (%.2f/%.2f MB)",
@@ -115,6 +121,43 @@ void _site_update_loading(gchar *file, goffset cur,
 	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), msg);
 	g_free(msg);
 }
+gboolean _site_update_progress(gpointer _data)
+{
+	RadarSiteProgress *data = _data;
+	RadarSite         *site = data->site;
+	/* Queued before update_end, but skip it if the site was reloaded */
+	if (site->status == STATUS_LOADING) {
+		GtkWidget *box      = gtk_bin_get_child(GTK_BIN(site->config));
+		GtkWidget *progress = g_object_get_data(G_OBJECT(box), "progress");
+		GtkWidget *sweeps   = g_object_get_data(G_OBJECT(box), "sweeps");
+		if (progress)
+			_set_progress(progress, data->cur, data->total);
+		if (sweeps && data->scan)
+			_gtk_bin_set_child(GTK_BIN(sweeps),
+				aweather_level2_get_scan_config(data->scan));
+	}
+	if (data->scan)
+		wsr88d_volume_free(data->scan);
+	g_free(data);
+	return FALSE;
+}
+
+/* format: http://mesonet.agron.iastate.edu/data/nexrd2/raw/KABR/KABR_20090510_0323 */
+void _site_update_loading(gchar *file, goffset cur,
+		goffset total, gpointer _site)
+{
+	RadarSite *site = _site;
+	RadarSiteProgress *data = g_new0(RadarSiteProgress, 1);
+	data->site  = site;
+	data->cur   = cur;
+	data->total = total;
+	if (site->stream) {
+		aweather_level2_stream_update(site->stream, file);
+		/* Show the sweeps found so far */
+		data->scan = aweather_level2_stream_scan(site->stream);
+	}
+	g_idle_add(_site_update_progress, data);
+}
 gboolean _site_update_end(gpointer _site)
 {
 	RadarSite *site = _site;
@@ -159,6 +202,7 @@ gpointer _site_update_thread(gpointer _site)
 	g_debug("RadarSite: update_thread - fetch");
 	gchar *local = g_strconcat(site->city->code, "/", nearest, NULL);
 	gchar *uri   = g_strconcat(nexrad_url, "/", local,   NULL);
+	site->stream = aweather_level2_stream_new(site->city->code);
 	gchar *file  = grits_http_fetch(site->http, uri, local,
 			offline ? GRITS_LOCAL : GRITS_UPDATE,
 			_site_update_loading, site);
@@ -167,19 +211,25 @@ gpointer _site_update_thread(gpointer _site)
 	g_free(local);
 	g_free(uri);
 	if (!file) {
+		aweather_level2_stream_finish(site->stream, NULL, NULL);
+		site->stream  = NULL;
 		site->message = "Fetch failed";
 		goto out;
 	}
 
-	/* Load and add new volume */
+	/* Finish decoding and add new volume */
 	g_debug("RadarSite: update_thread - load - %s", site->city->code);
-	site->level2 = aweather_level2_new_from_file(
-			file, site->city->code, colormaps);
+	site->level2 = aweather_level2_stream_finish(
+			site->stream, file, colormaps);
+	site->stream = NULL;
 	g_free(file);
 	if (!site->level2) {
 		site->message = "Load failed";
 		goto out;
 	}
+	gdouble res = grits_prefs_get_double(site->prefs, "aweather/iso_resolution", NULL);
+	if (res > 0)
+		site->level2->iso_resolution = res;
 	grits_object_hide(GRITS_OBJECT(site->level2), site->hidden);
 	grits_viewer_add(site->viewer, GRITS_OBJECT(site->level2),
 			GRITS_LEVEL_WORLD+3, TRUE);
@@ -198,14 +248,21 @@ void _site_update(RadarSite *site)
 	g_debug("RadarSite: update %s - %d",
 			site->city->code, (gint)site->time);
 
-	/* Add a progress bar */
+	/* Add a progress bar, with the sweeps above it once they're found */
 	GtkWidget *progress = gtk_progress_bar_new();
+	GtkWidget *sweeps   = gtk_alignment_new(0, 0, 1, 1);
+	GtkWidget *box      = gtk_vbox_new(FALSE, 0);
 	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress), "Loading...");
-	_gtk_bin_set_child(GTK_BIN(site->config), progress);
+	gtk_box_pack_start(GTK_BOX(box), sweeps,   FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(box), progress, FALSE, FALSE, 0);
+	g_object_set_data(G_OBJECT(box), "sweeps",   sweeps);
+	g_object_set_data(G_OBJECT(box), "progress", progress);
+	_gtk_bin_set_child(GTK_BIN(site->config), box);
 
 	/* Remove old volume */
 	g_debug("RadarSite: update - remove - %s", site->city->code);
 	if (site->level2) {
+		g_object_run_dispose(G_OBJECT(site->level2));
 		grits_viewer_remove(site->viewer, GRITS_OBJECT(site->level2));
 		site->level2 = NULL;
 	}
@@ -234,6 +291,7 @@ void radar_site_unload(RadarSite *site)
 
 	/* Remove radar */
 	if (site->level2) {
+		g_object_run_dispose(G_OBJECT(site->level2));
 		grits_viewer_remove(site->viewer, GRITS_OBJECT(site->level2));
 		site->level2 = NULL;
 	}
@@ -352,53 +410,86 @@ struct _RadarConus {
 	GStaticMutex loading;
 
 	gchar       *path;
+	guchar      *pixels[2];   // West and east halves, from the update thread
+	RadarTextureBuffer *buffer[2]; // Holding pixels, if they could be mapped
 	GritsTile   *tile[2];
+	RadarTextureUse *use[2];  // Counted in the texture budget, never evicted
 
 	guint        time_id;     // "time-changed"     callback ID
 	guint        refresh_id;  // "refresh"          callback ID
 };
 
+typedef struct {
+	RadarConus *conus;
+	goffset     cur;
+	goffset     total;
+} RadarConusProgress;
+gboolean _conus_update_progress(gpointer _data)
+{
+	RadarConusProgress *data = _data;
+	/* The progress bar is replaced once the update ends */
+	GtkWidget *progress = gtk_bin_get_child(GTK_BIN(data->conus->config));
+	if (GTK_IS_PROGRESS_BAR(progress))
+		_set_progress(progress, data->cur, data->total);
+	g_free(data);
+	return FALSE;
+}
 void _conus_update_loading(gchar *file, goffset cur,
 		goffset total, gpointer _conus)
 {
-	RadarConus *conus = _conus;
-	GtkWidget *progress_bar = gtk_bin_get_child(GTK_BIN(conus->config));
-	double percent = (double)cur/total;
-	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(progress_bar), MIN(percent, 1.0));
-	gchar *msg = g_strdup_printf("Loading... %5.1f%% (%.2f/%.2f MB)",
-			percent*100, (double)cur/1000000, (double)total/1000000);
-	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), msg);
-	g_free(msg);
+	RadarConusProgress *data = g_new0(RadarConusProgress, 1);
+	data->conus = _conus;
+	data->cur   = cur;
+	data->total = total;
+	g_idle_add(_conus_update_progress, data);
 }
 
-/* Copy images to graphics memory */
-static void _conus_update_end_copy(GritsTile *tile, guchar *pixels)
+/* Copy images to graphics memory, with a clear border of one texel so the
+ * edges of the tile are transparent. Returns the size of the texture. */
+static gsize _conus_update_end_copy(GritsTile *tile, guchar *pixels,
+		RadarTextureBuffer *buffer)
 {
 	if (!tile->data) {
 		tile->data = g_new0(guint, 1);
 		glGenTextures(1, tile->data);
 	}
 
-	gchar *clear = g_malloc0(2048*2048*4);
+	gint width  = CONUS_WIDTH/2 + 2;
+	gint height = CONUS_HEIGHT  + 2;
+	gint tex_width, tex_height;
+	radar_texture_size(width, height, 4, &tex_width, &tex_height);
+
+	gchar *clear = g_malloc0(MAX(width, height)*4);
 	guint *tex = tile->data;
 	glBindTexture(GL_TEXTURE_2D, *tex);
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D, 0, 4, 2048, 2048, 0,
+	glTexImage2D(GL_TEXTURE_2D, 0, 4, tex_width, tex_height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0,0,        width,1,
+			GL_RGBA, GL_UNSIGNED_BYTE, clear);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0,height-1, width,1,
+			GL_RGBA, GL_UNSIGNED_BYTE, clear);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0,0,        1,height,
+			GL_RGBA, GL_UNSIGNED_BYTE, clear);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, width-1,0,  1,height,
 			GL_RGBA, GL_UNSIGNED_BYTE, clear);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 1,1, CONUS_WIDTH/2,CONUS_HEIGHT,
-			GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-	tile->coords.n = 1.0/(CONUS_WIDTH/2);
-	tile->coords.w = 1.0/ CONUS_HEIGHT;
-	tile->coords.s = tile->coords.n +  CONUS_HEIGHT   / 2048.0;
-	tile->coords.e = tile->coords.w + (CONUS_WIDTH/2) / 2048.0;
+	if (buffer)
+		radar_texture_upload_buffer(buffer, GL_RGBA,
+				1,1, CONUS_WIDTH/2,CONUS_HEIGHT);
+	else
+		radar_texture_upload(GL_RGBA, 1,1, CONUS_WIDTH/2,CONUS_HEIGHT, pixels);
+	tile->coords.n = 1.0/tex_height;
+	tile->coords.w = 1.0/tex_width;
+	tile->coords.s = tile->coords.n +  CONUS_HEIGHT   / tex_height;
+	tile->coords.e = tile->coords.w + (CONUS_WIDTH/2) / tex_width;
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glFlush();
 	g_free(clear);
+	return (gsize)tex_width * tex_height * 4;
 }
 
 /* Split the pixbuf into east and west halves (with 2K sides)
@@ -449,32 +540,16 @@ gboolean _conus_update_end(gpointer _conus)
 		goto out;
 	}
 
-	/* Load and pixbuf */
-	GError *error = NULL;
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(conus->path, &error);
-	if (!pixbuf || error) {
-		g_warning("Conus: update_end - error loading pixbuf: %s", conus->path);
-		_gtk_bin_set_child(GTK_BIN(conus->config), gtk_label_new("Error loading pixbuf"));
-		g_remove(conus->path);
-		goto out;
-	}
-
-	/* Split pixels into east/west parts */
-	guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
-	gint    width  = gdk_pixbuf_get_width(pixbuf);
-	gint    height = gdk_pixbuf_get_height(pixbuf);
-	gint    pxsize = gdk_pixbuf_get_has_alpha(pixbuf) ? 4 : 3;
-	guchar *pixels_west = g_malloc(4*(width/2)*height);
-	guchar *pixels_east = g_malloc(4*(width/2)*height);
-	_conus_update_end_split(pixels, pixels_west, pixels_east,
-			width, height, pxsize);
-	g_object_unref(pixbuf);
-
 	/* Copy pixels to graphics memory */
-	_conus_update_end_copy(conus->tile[0], pixels_west);
-	_conus_update_end_copy(conus->tile[1], pixels_east);
-	g_free(pixels_west);
-	g_free(pixels_east);
+	for (int i = 0; i < 2; i++) {
+		gsize size = _conus_update_end_copy(conus->tile[i],
+				conus->pixels[i], conus->buffer[i]);
+		if (conus->buffer[i])
+			conus->pixels[i] = NULL;
+		conus->buffer[i] = NULL;
+		radar_texture_untrack(conus->use[i]);
+		conus->use[i] = radar_texture_track(size, NULL, conus, i);
+	}
 
 	/* Update GUI */
 	gchar *label = g_path_get_basename(conus->path);
@@ -483,6 +558,14 @@ gboolean _conus_update_end(gpointer _conus)
 	g_free(label);
 
 out:
+	for (int i = 0; i < 2; i++) {
+		if (conus->buffer[i])
+			radar_texture_unmap(conus->buffer[i]);
+		else
+			g_free(conus->pixels[i]);
+		conus->buffer[i] = NULL;
+		conus->pixels[i] = NULL;
+	}
 	g_free(conus->path);
 	g_static_mutex_unlock(&conus->loading);
 	return FALSE;
@@ -534,6 +617,37 @@ gpointer _conus_update_thread(gpointer _conus)
 		goto out;
 	}
 
+	/* Load the pixbuf and split pixels into east/west parts, these are
+	 * written straight into pixel buffers when they can be mapped so the
+	 * main thread only needs to start the upload */
+	g_debug("Conus: update_thread - split");
+	GError *error = NULL;
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(conus->path, &error);
+	if (!pixbuf || error) {
+		g_warning("Conus: update_thread - error loading pixbuf: %s", conus->path);
+		conus->message = "Error loading pixbuf";
+		g_remove(conus->path);
+		if (error)
+			g_error_free(error);
+		if (pixbuf)
+			g_object_unref(pixbuf);
+		goto out;
+	}
+	guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+	gint    width  = gdk_pixbuf_get_width(pixbuf);
+	gint    height = gdk_pixbuf_get_height(pixbuf);
+	gint    pxsize = gdk_pixbuf_get_has_alpha(pixbuf) ? 4 : 3;
+	for (int i = 0; i < 2; i++) {
+		gsize size = 4*(width/2)*height;
+		conus->buffer[i] = radar_texture_map(size);
+		conus->pixels[i] = conus->buffer[i]
+			? radar_texture_buffer_data(conus->buffer[i])
+			: g_malloc(size);
+	}
+	_conus_update_end_split(pixels, conus->pixels[0], conus->pixels[1],
+			width, height, pxsize);
+	g_object_unref(pixbuf);
+
 out:
 	g_debug("Conus: update_thread - done");
 	g_idle_add(_conus_update_end, conus);
@@ -595,6 +709,7 @@ void radar_conus_free(RadarConus *conus)
 
 	for (int i = 0; i < 2; i++) {
 		GritsTile *tile = conus->tile[i];
+		radar_texture_untrack(conus->use[i]);
 		if (tile->data) {
 			glDeleteTextures(1, tile->data);
 			g_free(tile->data);
@@ -629,7 +744,7 @@ static void _draw_hud(GritsCallback *callback, GritsOpenGL *opengl, gpointer _se
 	while (g_hash_table_iter_next(&iter, &name, &_site)) {
 		/* Pick correct colormaps */
 		RadarSite *site = _site;
-		if (site->hidden || !site->level2)
+		if (site->hidden || !site->level2 || !site->level2->sweep_colors)
 			continue;
 		AWeatherColormap *colormap = site->level2->sweep_colors;
 
@@ -647,32 +762,6 @@ static void _draw_hud(GritsCallback *callback, GritsOpenGL *opengl, gpointer _se
 	}
 }
 
-static void _load_colormap(gchar *filename, AWeatherColormap *cm)
-{
-	g_debug("GritsPluginRadar: _load_colormap - %s", filename);
-	FILE *file = fopen(filename, "r");
-	if (!file)
-		g_error("GritsPluginRadar: open failed");
-	guint8 color[4];
-	GArray *array = g_array_sized_new(FALSE, TRUE, sizeof(color), 256);
-	if (!fgets(cm->name, sizeof(cm->name), file)) goto out;
-	if (!fscanf(file, "%f\n", &cm->scale))        goto out;
-	if (!fscanf(file, "%f\n", &cm->shift))        goto out;
-	int r, g, b, a;
-	while (fscanf(file, "%d %d %d %d\n", &r, &g, &b, &a) == 4) {
-		color[0] = r;
-		color[1] = g;
-		color[2] = b;
-		color[3] = a;
-		g_array_append_val(array, color);
-	}
-	cm->len  = (gint )array->len;
-	cm->data = (void*)array->data;
-out:
-	g_array_free(array, FALSE);
-	fclose(file);
-}
-
 static void _update_hidden(GtkNotebook *notebook,
 		GtkNotebookPage *page, guint page_num, gpointer viewer)
 {
@@ -709,6 +798,11 @@ GritsPluginRadar *grits_plugin_radar_new(GritsViewer *viewer, GritsPrefs *prefs)
 	self->viewer = viewer;
 	self->prefs  = prefs;
 
+	/* Limit memory used by textures, in MB */
+	gint budget = grits_prefs_get_integer(prefs, "aweather/texture_budget", NULL);
+	if (budget > 0)
+		radar_texture_set_budget((gsize)budget*1024*1024);
+
 	/* Setup page switching */
 	self->tab_id = g_signal_connect(self->config, "switch-page",
 			G_CALLBACK(_update_hidden), viewer);
@@ -767,7 +861,7 @@ static void grits_plugin_radar_init(GritsPluginRadar *self)
 	for (int i = 0; colormaps[i].file; i++) {
 		gchar *file = g_build_filename(PKGDATADIR,
 				"colors", colormaps[i].file, NULL);
-		_load_colormap(file, &colormaps[i]);
+		colormap_load(file, &colormaps[i]);
 		g_free(file);
 	}
 
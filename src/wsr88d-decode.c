@@ -0,0 +1,896 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "wsr88d.h"
+#include "wsr88d-decode.h"
+
+/* Interface Control Document for the Archive II/User, RPG Build 12.0
+ * http://www.roc.noaa.gov/wsr88d/BuildInfo/Files.aspx */
+
+#define CTM_SIZE     12   // Channel Terminal Manager, ignored
+#define HEADER_SIZE  16   // Message header
+#define FRAME_SIZE   2432 // Every message except 31 is padded to this
+#define MSG31_SIZE   32   // Message 31 header, before the block pointers
+#define MSG1_SIZE    100  // Message 1 digital radar data header
+#define BLOCK_SIZE   28   // Message 31 moment data block header
+
+const gchar *wsr88d_moment_names[WSR88D_MOMENTS] = {
+	[WSR88D_REF] = "Reflectivity",
+	[WSR88D_VEL] = "Velocity",
+	[WSR88D_SW]  = "Spectrum Width",
+	[WSR88D_ZDR] = "Differential Reflectivity",
+	[WSR88D_PHI] = "Differential Phase",
+	[WSR88D_RHO] = "Correlation Coefficient",
+};
+
+/* Block names used by Message 31 */
+static const gchar *block_names[WSR88D_MOMENTS] = {
+	[WSR88D_REF] = "REF",
+	[WSR88D_VEL] = "VEL",
+	[WSR88D_SW]  = "SW ",
+	[WSR88D_ZDR] = "ZDR",
+	[WSR88D_PHI] = "PHI",
+	[WSR88D_RHO] = "RHO",
+};
+
+/* Decompressed data pushed into the volume, freed once every
+ * radial pointing into it has been decoded */
+typedef struct {
+	guint8 *data;
+	guint   refs;
+} Chunk;
+
+/* A single radial of a single moment, still in the message */
+typedef struct {
+	Chunk        *chunk;
+	const guint8 *gates;
+	guint         ngates;
+	gfloat        azimuth;
+	gfloat        elev;
+} Radial;
+
+/* Everything is big endian and may not be aligned */
+static inline guint16 _get16(const guint8 *data, gsize off)
+{
+	return data[off] << 8 | data[off+1];
+}
+
+static inline guint32 _get32(const guint8 *data, gsize off)
+{
+	return (guint32)data[off]   << 24 | (guint32)data[off+1] << 16 |
+	       (guint32)data[off+2] <<  8 | (guint32)data[off+3];
+}
+
+static inline gfloat _getf(const guint8 *data, gsize off)
+{
+	union { guint32 i; gfloat f; } val = { _get32(data, off) };
+	return val.f;
+}
+
+/* Angles in Message 1 and 5 are binary angles */
+static inline gfloat _get_angle(const guint8 *data, gsize off)
+{
+	return _get16(data, off) * (180.0 / 32768.0);
+}
+
+/********************
+ * Scanning radials *
+ ********************/
+static Wsr88dSweep *_get_sweep(Wsr88dVolume *volume,
+		Wsr88dMoment moment, guint elev_num)
+{
+	/* Radials usually arrive a whole elevation at a time, so the
+	 * matching sweep is almost always one of the last few */
+	for (gint i = volume->scanning->len-1; i >= 0; i--) {
+		Wsr88dSweep *sweep = g_ptr_array_index(volume->scanning, i);
+		if (sweep->moment == moment && sweep->elev_num == elev_num)
+			return sweep;
+	}
+	Wsr88dSweep *sweep = g_new0(Wsr88dSweep, 1);
+	sweep->moment   = moment;
+	sweep->elev_num = elev_num;
+	sweep->radials  = g_array_new(FALSE, FALSE, sizeof(Radial));
+	g_ptr_array_add(volume->scanning, sweep);
+	return sweep;
+}
+
+static void _add_radial(Wsr88dVolume *volume, Wsr88dMoment moment,
+		guint elev_num, Wsr88dSweep *params, Radial *radial)
+{
+	Wsr88dSweep *sweep = _get_sweep(volume, moment, elev_num);
+	if (sweep->radials->len == 0) {
+		sweep->beam_width = params->beam_width;
+		sweep->range_bin1 = params->range_bin1;
+		sweep->gate_size  = params->gate_size;
+		sweep->nyquist    = params->nyquist;
+		sweep->scale      = params->scale;
+		sweep->offset     = params->offset;
+		sweep->word_size  = params->word_size;
+	}
+	radial->chunk = g_ptr_array_index(volume->chunks, volume->chunks->len-1);
+	radial->chunk->refs++;
+	g_array_append_vals(sweep->radials, radial, 1);
+}
+
+/* Message 31, digital radar data generic format */
+static gboolean _scan_msg31(Wsr88dVolume *volume, const guint8 *msg, gsize len)
+{
+	if (len < MSG31_SIZE)
+		return FALSE;
+	if (msg[16] != 0) // compressed radial
+		return TRUE;
+
+	Radial      radial = {};
+	Wsr88dSweep params = {};
+	guint elev_num     = msg[22];
+	guint nblocks      = _get16(msg, 30);
+	radial.azimuth     = _getf(msg, 12);
+	radial.elev        = _getf(msg, 24);
+	params.beam_width  = msg[20] == 1 ? 0.5 : 1.0;
+	if (len < MSG31_SIZE + 4*nblocks)
+		return FALSE;
+
+	for (guint i = 0; i < nblocks; i++) {
+		guint32 ptr = _get32(msg, MSG31_SIZE + 4*i);
+		if (ptr + 4 > len)
+			return FALSE;
+		const guint8 *block = msg + ptr;
+
+		/* Volume and radial constants */
+		if (!memcmp(block, "RVOL", 4) && ptr + 44 <= len) {
+			if (!volume->located) {
+				volume->lat     = _getf(block, 8);
+				volume->lon     = _getf(block, 12);
+				volume->height  = (gint16)_get16(block, 16);
+				volume->vcp     = _get16(block, 40);
+				volume->located = TRUE;
+			}
+			continue;
+		}
+		if (!memcmp(block, "RRAD", 4) && ptr + 18 <= len) {
+			params.nyquist = _get16(block, 16) / 100.0;
+			continue;
+		}
+		if (block[0] != 'D' || ptr + BLOCK_SIZE > len)
+			continue;
+
+		/* Moment data */
+		Wsr88dMoment moment;
+		for (moment = 0; moment < WSR88D_MOMENTS; moment++)
+			if (!memcmp(block+1, block_names[moment], 3))
+				break;
+		if (moment == WSR88D_MOMENTS)
+			continue;
+		radial.ngates     = _get16(block, 8);
+		radial.gates      = block + BLOCK_SIZE;
+		params.range_bin1 = (gint16)_get16(block, 10);
+		params.gate_size  = _get16(block, 12);
+		params.word_size  = block[19];
+		params.scale      = _getf(block, 20);
+		params.offset     = _getf(block, 24);
+		if ((params.word_size != 8 && params.word_size != 16) ||
+		    params.scale == 0 ||
+		    ptr + BLOCK_SIZE + radial.ngates*params.word_size/8 > len)
+			continue;
+		_add_radial(volume, moment, elev_num, &params, &radial);
+	}
+	return TRUE;
+}
+
+/* Message 1, digital radar data used before Build 10 */
+static gboolean _scan_msg1(Wsr88dVolume *volume, const guint8 *msg, gsize len)
+{
+	if (len < MSG1_SIZE)
+		return FALSE;
+
+	Radial      radial = {};
+	Wsr88dSweep params = {};
+	guint elev_num     = _get16(msg, 16);
+	radial.azimuth     = _get_angle(msg, 8);
+	radial.elev        = _get_angle(msg, 14);
+	params.beam_width  = 1.0;
+	params.nyquist     = _get16(msg, 60) / 100.0;
+	params.word_size   = 8;
+	if (!volume->vcp)
+		volume->vcp = _get16(msg, 44);
+
+	/* Reflectivity: (code-2)/2 - 32 */
+	guint16 nrefl = _get16(msg, 26), refl_ptr = _get16(msg, 36);
+	if (nrefl && refl_ptr && refl_ptr + nrefl <= len) {
+		radial.gates      = msg + refl_ptr;
+		radial.ngates     = nrefl;
+		params.range_bin1 = (gint16)_get16(msg, 18);
+		params.gate_size  = _get16(msg, 22);
+		params.scale      = 2;
+		params.offset     = 66;
+		_add_radial(volume, WSR88D_REF, elev_num, &params, &radial);
+	}
+
+	/* Velocity: (code-2)/2 - 63.5 or (code-2) - 127
+	 * Spectrum width: (code-2)/2 - 63.5 */
+	guint16 ndopp   = _get16(msg, 28);
+	guint16 vel_ptr = _get16(msg, 38), sw_ptr = _get16(msg, 40);
+	params.range_bin1 = (gint16)_get16(msg, 20);
+	params.gate_size  = _get16(msg, 24);
+	params.offset     = 129;
+	radial.ngates     = ndopp;
+	if (ndopp && vel_ptr && vel_ptr + ndopp <= len) {
+		radial.gates  = msg + vel_ptr;
+		params.scale  = _get16(msg, 42) == 4 ? 1 : 2;
+		_add_radial(volume, WSR88D_VEL, elev_num, &params, &radial);
+	}
+	if (ndopp && sw_ptr && sw_ptr + ndopp <= len) {
+		radial.gates  = msg + sw_ptr;
+		params.scale  = 2;
+		_add_radial(volume, WSR88D_SW, elev_num, &params, &radial);
+	}
+	return TRUE;
+}
+
+/* Message 5, volume coverage pattern */
+static void _scan_msg5(Wsr88dVolume *volume, const guint8 *msg, gsize len)
+{
+	if (len < 22 || volume->cuts)
+		return;
+	guint ncuts = _get16(msg, 6);
+	if (len < 22 + 46*ncuts)
+		return;
+	volume->vcp   = _get16(msg, 4);
+	volume->ncuts = ncuts;
+	volume->cuts  = g_new0(gfloat, ncuts);
+	for (guint i = 0; i < ncuts; i++)
+		volume->cuts[i] = _get_angle(msg, 22 + 46*i);
+}
+
+/* Scan all the complete messages in a chunk, returns the
+ * number of bytes used, the rest is an incomplete message */
+static gsize _scan_chunk(Wsr88dVolume *volume, const guint8 *data, gsize len)
+{
+	gsize off = 0;
+	while (off + CTM_SIZE + HEADER_SIZE <= len) {
+		const guint8 *header = data + off + CTM_SIZE;
+		guint  type = header[3];
+		gsize  size = type == 31 ? CTM_SIZE + 2*_get16(header, 0) : FRAME_SIZE;
+		if (size < CTM_SIZE + HEADER_SIZE) {
+			g_warning("Wsr88dVolume: scan_chunk - bad message size %u",
+					(guint)size);
+			volume->failed = TRUE;
+			return len;
+		}
+		if (off + size > len)
+			break;
+
+		/* Message body, after the header */
+		const guint8 *body = header + HEADER_SIZE;
+		gsize body_len = size - CTM_SIZE - HEADER_SIZE;
+		gboolean ok = TRUE;
+		switch (type) {
+		case 31: ok = _scan_msg31(volume, body, body_len); break;
+		case 1:  ok = _scan_msg1(volume, body, body_len);  break;
+		case 5:  _scan_msg5(volume, body, body_len);       break;
+		}
+		if (!ok)
+			g_debug("Wsr88dVolume: scan_chunk - bad type %u message", type);
+		off += size;
+	}
+	return off;
+}
+
+/********************
+ * Decoding sweeps *
+ ********************/
+static gint _sort_radials(gconstpointer _a, gconstpointer _b)
+{
+	const Radial *a = _a, *b = _b;
+	return a->azimuth < b->azimuth ? -1 :
+	       a->azimuth > b->azimuth ?  1 : 0;
+}
+
+static gint _sort_sweeps(gconstpointer _a, gconstpointer _b)
+{
+	const Wsr88dSweep *a = *(Wsr88dSweep**)_a, *b = *(Wsr88dSweep**)_b;
+	if (a->moment   != b->moment)   return a->moment < b->moment ? -1 : 1;
+	if (a->elev     != b->elev)     return a->elev   < b->elev   ? -1 : 1;
+	if (a->elev_num != b->elev_num) return a->elev_num < b->elev_num ? -1 : 1;
+	return 0;
+}
+
+/* Order the sweeps were recorded in, every moment of an elevation at once */
+static gint _sort_recorded(gconstpointer _a, gconstpointer _b, gpointer data)
+{
+	const Wsr88dSweep *a = *(Wsr88dSweep**)_a, *b = *(Wsr88dSweep**)_b;
+	if (a->elev_num != b->elev_num) return a->elev_num < b->elev_num ? -1 : 1;
+	if (a->moment   != b->moment)   return a->moment < b->moment ? -1 : 1;
+	return 0;
+}
+
+/* Use the angle from the VCP, so split cuts match each other */
+static gfloat _sweep_elev(Wsr88dVolume *volume, Wsr88dSweep *sweep, gfloat mean)
+{
+	if (sweep->elev_num >= 1 && sweep->elev_num <= volume->ncuts)
+		return volume->cuts[sweep->elev_num-1];
+	return mean;
+}
+
+/* Sort the rays and fill in everything except the gates */
+static void _index_sweep(Wsr88dVolume *volume, Wsr88dSweep *sweep)
+{
+	GArray *radials = sweep->radials;
+	g_array_sort(radials, _sort_radials);
+
+	sweep->nrays  = radials->len;
+	sweep->ngates = 0;
+	sweep->rays   = g_new0(Wsr88dRay, sweep->nrays);
+	gdouble elev  = 0;
+	for (guint i = 0; i < radials->len; i++) {
+		Radial *radial = &g_array_index(radials, Radial, i);
+		sweep->ngates  = MAX(sweep->ngates, radial->ngates);
+		sweep->rays[i].azimuth = radial->azimuth;
+		sweep->rays[i].elev    = radial->elev;
+		elev += radial->elev;
+	}
+
+	sweep->elev = _sweep_elev(volume, sweep, elev / MAX(radials->len, 1));
+}
+
+/* Copy the gates from the messages into a single array */
+static void _decode_sweep(Wsr88dSweep *sweep)
+{
+	GArray *radials = sweep->radials;
+	guint8 *data    = g_malloc0(sweep->nrays * sweep->ngates);
+
+	/* 16 bit moments are shifted down until the largest code fits in 8
+	 * bits, the special codes are kept as they are */
+	guint shift = 0;
+	if (sweep->word_size == 16) {
+		guint max = 0;
+		for (guint i = 0; i < radials->len; i++) {
+			Radial *radial = &g_array_index(radials, Radial, i);
+			for (guint g = 0; g < radial->ngates; g++)
+				max = MAX(max, _get16(radial->gates, 2*g));
+		}
+		while ((max >> shift) > 0xff)
+			shift++;
+		sweep->scale  /= 1 << shift;
+		sweep->offset /= 1 << shift;
+	}
+
+	for (guint i = 0; i < radials->len; i++) {
+		Radial *radial = &g_array_index(radials, Radial, i);
+		guint8 *row    = data + i*sweep->ngates;
+		if (sweep->word_size == 8) {
+			memcpy(row, radial->gates, radial->ngates);
+		} else {
+			for (guint g = 0; g < radial->ngates; g++) {
+				guint code = _get16(radial->gates, 2*g);
+				row[g] = code <= WSR88D_RANGE_FOLDED ? code :
+					MAX(code >> shift, WSR88D_RANGE_FOLDED+1);
+			}
+		}
+
+		/* Drop the decompressed data once nothing else needs it */
+		if (--radial->chunk->refs == 0) {
+			g_free(radial->chunk->data);
+			radial->chunk->data = NULL;
+		}
+	}
+
+	g_array_free(radials, TRUE);
+	sweep->radials = NULL;
+	sweep->data    = data;
+}
+
+static void _free_sweep(Wsr88dSweep *sweep)
+{
+	if (sweep->radials)
+		g_array_free(sweep->radials, TRUE);
+	g_free(sweep->rays);
+	g_free(sweep->data);
+	g_free(sweep);
+}
+
+
+/****************
+ * Volume cache *
+ ****************/
+#define CACHE_MAGIC   "WSR88DV2"
+#define CACHE_ORDER   0x01020304
+#define CACHE_ALIGN   16
+
+typedef struct {
+	gchar   magic[8];
+	guint32 order;        // Byte order and version check
+	guint32 nsweeps;
+	gchar   site[8];
+	gint64  time;
+	guint32 vcp;
+	guint32 located;
+	gfloat  lat;
+	gfloat  lon;
+	gfloat  height;
+	guint32 pad[3];       // Keep the sweep headers aligned
+} CacheHeader;
+
+typedef struct {
+	guint32 moment;
+	guint32 elev_num;
+	gfloat  elev;
+	gfloat  beam_width;
+	gfloat  range_bin1;
+	gfloat  gate_size;
+	gfloat  nyquist;
+	gfloat  scale;
+	gfloat  offset;
+	guint32 nrays;
+	guint32 ngates;
+	guint32 pad;
+	guint64 rays;         // File offset of the ray headers
+	guint64 data;         // File offset of the gate codes
+	guint64 packed;       // Size of the packed gate codes, 0 if not packed
+	guint64 pad2;
+} CacheSweep;
+
+static gsize _cache_align(gsize off)
+{
+	return (off + CACHE_ALIGN-1) & ~(gsize)(CACHE_ALIGN-1);
+}
+
+/* Gate codes are packed with PackBits, a header byte n is followed by n+1
+ * literal bytes for n < 128, or by one byte repeated 257-n times for n > 128.
+ * Most of a sweep is below threshold, which packs down to two bytes for every
+ * 128 gates, and unpacking is little more than memset and memcpy. */
+static guint8 *_cache_pack(const guint8 *data, gsize len, gsize *packed_len)
+{
+	guint8 *out = g_malloc(len + len/128 + 1);
+	gsize   i = 0, o = 0;
+	while (i < len) {
+		gsize run = 1;
+		while (i+run < len && run < 128 && data[i+run] == data[i])
+			run++;
+		if (run >= 3) {
+			out[o++] = 257 - run;
+			out[o++] = data[i];
+			i += run;
+			continue;
+		}
+		/* Literals, up to the next run of three or more */
+		gsize lit = 1;
+		while (i+lit < len && lit < 128 && !(i+lit+2 < len &&
+		       data[i+lit] == data[i+lit+1] && data[i+lit] == data[i+lit+2]))
+			lit++;
+		out[o++] = lit - 1;
+		memcpy(out+o, data+i, lit);
+		o += lit;
+		i += lit;
+	}
+	*packed_len = o;
+	return out;
+}
+
+static gboolean _cache_unpack(const guint8 *in, gsize len, guint8 *data, gsize size)
+{
+	gsize i = 0, o = 0;
+	while (i < len) {
+		guint n = in[i++];
+		if (n < 128) {
+			if (i+n+1 > len || o+n+1 > size)
+				return FALSE;
+			memcpy(data+o, in+i, n+1);
+			i += n+1;
+			o += n+1;
+		} else if (n > 128) {
+			if (i+1 > len || o+257-n > size)
+				return FALSE;
+			memset(data+o, in[i++], 257-n);
+			o += 257-n;
+		}
+	}
+	return o == size;
+}
+
+static gboolean _cache_write(FILE *fp, gsize *off, const void *data, gsize len)
+{
+	static const gchar zero[CACHE_ALIGN];
+	gsize pad = _cache_align(*off) - *off;
+	if (fwrite(zero, 1, pad, fp) != pad || fwrite(data, 1, len, fp) != len)
+		return FALSE;
+	*off += pad + len;
+	return TRUE;
+}
+
+gboolean wsr88d_volume_save(Wsr88dVolume *volume, const gchar *file)
+{
+	wsr88d_volume_load_all(volume);
+
+	/* Headers first, the arrays are laid out after them */
+	CacheHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	memcpy(header.site, volume->site, sizeof(volume->site));
+	header.order    = CACHE_ORDER;
+	header.nsweeps  = volume->nsweeps;
+	header.time     = volume->time;
+	header.vcp      = volume->vcp;
+	header.located  = volume->located;
+	header.lat      = volume->lat;
+	header.lon      = volume->lon;
+	header.height   = volume->height;
+
+	CacheSweep *sweeps = g_new0(CacheSweep, volume->nsweeps);
+	guint8    **packed = g_new0(guint8*, volume->nsweeps);
+	gsize off = sizeof(CacheHeader) + volume->nsweeps*sizeof(CacheSweep);
+	for (guint i = 0; i < volume->nsweeps; i++) {
+		Wsr88dSweep *sweep = volume->sweeps[i];
+		if (!sweep->data) {
+			for (guint j = 0; j < i; j++)
+				g_free(packed[j]);
+			g_free(packed);
+			g_free(sweeps);
+			return FALSE;
+		}
+
+		/* Only keep the packed codes if they're a lot smaller */
+		gsize size = sweep->nrays * sweep->ngates, packed_len;
+		packed[i] = _cache_pack(sweep->data, size, &packed_len);
+		if (packed_len < size*3/4) {
+			sweeps[i].packed = packed_len;
+		} else {
+			g_free(packed[i]);
+			packed[i] = NULL;
+		}
+
+		sweeps[i].moment     = sweep->moment;
+		sweeps[i].elev_num   = sweep->elev_num;
+		sweeps[i].elev       = sweep->elev;
+		sweeps[i].beam_width = sweep->beam_width;
+		sweeps[i].range_bin1 = sweep->range_bin1;
+		sweeps[i].gate_size  = sweep->gate_size;
+		sweeps[i].nyquist    = sweep->nyquist;
+		sweeps[i].scale      = sweep->scale;
+		sweeps[i].offset     = sweep->offset;
+		sweeps[i].nrays      = sweep->nrays;
+		sweeps[i].ngates     = sweep->ngates;
+		sweeps[i].rays       = off = _cache_align(off);
+		off += sweep->nrays * sizeof(Wsr88dRay);
+		sweeps[i].data       = off = _cache_align(off);
+		off += packed[i] ? packed_len : size;
+	}
+
+	/* Write to a temporary file so readers never see half a cache */
+	gchar *tmp = g_strconcat(file, ".part", NULL);
+	FILE  *fp  = g_fopen(tmp, "wb");
+	gboolean ok = fp != NULL;
+	off = 0;
+	ok = ok && _cache_write(fp, &off, &header, sizeof(header));
+	ok = ok && _cache_write(fp, &off, sweeps, volume->nsweeps*sizeof(CacheSweep));
+	for (guint i = 0; ok && i < volume->nsweeps; i++) {
+		Wsr88dSweep *sweep = volume->sweeps[i];
+		ok = ok && _cache_write(fp, &off, sweep->rays,
+				sweep->nrays * sizeof(Wsr88dRay));
+		if (packed[i])
+			ok = ok && _cache_write(fp, &off, packed[i], sweeps[i].packed);
+		else
+			ok = ok && _cache_write(fp, &off, sweep->data,
+					sweep->nrays * sweep->ngates);
+	}
+	if (fp && fclose(fp) != 0)
+		ok = FALSE;
+	if (ok && g_rename(tmp, file) != 0)
+		ok = FALSE;
+	if (!ok) {
+		g_warning("Wsr88dVolume: save - error writing %s", file);
+		g_remove(tmp);
+	}
+	for (guint i = 0; i < volume->nsweeps; i++)
+		g_free(packed[i]);
+	g_free(packed);
+	g_free(sweeps);
+	g_free(tmp);
+	return ok;
+}
+
+Wsr88dVolume *wsr88d_volume_map(const gchar *file)
+{
+	GMappedFile *mapped = g_mapped_file_new(file, FALSE, NULL);
+	if (!mapped)
+		return NULL;
+	const guint8 *data = (guint8*)g_mapped_file_get_contents(mapped);
+	gsize         len  = g_mapped_file_get_length(mapped);
+
+	/* Check everything points inside the file before using it */
+	const CacheHeader *header = (CacheHeader*)data;
+	const CacheSweep  *sweeps = (CacheSweep*)(header+1);
+	gboolean ok = len >= sizeof(CacheHeader) &&
+		!memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) &&
+		header->order == CACHE_ORDER &&
+		header->nsweeps <= (len - sizeof(CacheHeader)) / sizeof(CacheSweep);
+	for (guint i = 0; ok && i < header->nsweeps; i++) {
+		guint64 rays  = (guint64)sweeps[i].nrays * sizeof(Wsr88dRay);
+		guint64 gates = sweeps[i].packed ? sweeps[i].packed :
+			(guint64)sweeps[i].nrays * sweeps[i].ngates;
+		ok = sweeps[i].moment < WSR88D_MOMENTS &&
+			sweeps[i].rays <= len && rays  <= len - sweeps[i].rays &&
+			sweeps[i].data <= len && gates <= len - sweeps[i].data;
+	}
+	if (!ok) {
+		g_warning("Wsr88dVolume: map - invalid cache %s", file);
+		g_mapped_file_free(mapped);
+		return NULL;
+	}
+
+	Wsr88dVolume *volume = wsr88d_volume_new();
+	memcpy(volume->site, header->site, 4);
+	volume->time     = header->time;
+	volume->vcp      = header->vcp;
+	volume->located  = header->located;
+	volume->lat      = header->lat;
+	volume->lon      = header->lon;
+	volume->height   = header->height;
+	volume->mapped   = mapped;
+	volume->nsweeps  = header->nsweeps;
+	volume->sweeps   = g_new0(Wsr88dSweep*, volume->nsweeps);
+	for (guint i = 0; i < volume->nsweeps; i++) {
+		Wsr88dSweep *sweep = volume->sweeps[i] = g_new0(Wsr88dSweep, 1);
+		sweep->moment     = sweeps[i].moment;
+		sweep->elev_num   = sweeps[i].elev_num;
+		sweep->elev       = sweeps[i].elev;
+		sweep->beam_width = sweeps[i].beam_width;
+		sweep->range_bin1 = sweeps[i].range_bin1;
+		sweep->gate_size  = sweeps[i].gate_size;
+		sweep->nyquist    = sweeps[i].nyquist;
+		sweep->scale      = sweeps[i].scale;
+		sweep->offset     = sweeps[i].offset;
+		sweep->nrays      = sweeps[i].nrays;
+		sweep->ngates     = sweeps[i].ngates;
+		sweep->rays       = (Wsr88dRay*)(data + sweeps[i].rays);
+		if (sweeps[i].packed) {
+			sweep->packed     = data + sweeps[i].data;
+			sweep->packed_len = sweeps[i].packed;
+		} else {
+			sweep->data       = (guint8*)(data + sweeps[i].data);
+		}
+	}
+	g_ptr_array_free(volume->scanning, TRUE);
+	g_byte_array_free(volume->partial, TRUE);
+	volume->scanning = NULL;
+	volume->partial  = NULL;
+	return volume;
+}
+
+
+/***********
+ * Methods *
+ ***********/
+Wsr88dVolume *wsr88d_volume_new(void)
+{
+	Wsr88dVolume *volume = g_new0(Wsr88dVolume, 1);
+	volume->chunks   = g_ptr_array_new();
+	volume->partial  = g_byte_array_new();
+	volume->scanning = g_ptr_array_new();
+	volume->lock     = g_mutex_new();
+	return volume;
+}
+
+gboolean wsr88d_volume_push(Wsr88dVolume *volume, const gchar *data, gsize len)
+{
+	if (volume->failed)
+		return FALSE;
+
+	/* Volume header: "AR2V0006.", extension, date, time, site */
+	if (!volume->header) {
+		guint need = WSR88D_HEADER_SIZE - volume->partial->len;
+		g_byte_array_append(volume->partial, (guint8*)data, MIN(len, need));
+		if (len < need)
+			return TRUE;
+		const guint8 *header = volume->partial->data;
+		guint32 date = _get32(header, 12);
+		guint32 ms   = _get32(header, 16);
+		volume->time = (time_t)(date-1)*24*60*60 + ms/1000;
+		memcpy(volume->site, header+20, 4);
+		g_byte_array_set_size(volume->partial, 0);
+		volume->header = TRUE;
+		data += need;
+		len  -= need;
+	}
+	if (len == 0)
+		return TRUE;
+
+	/* Keep the data around, the radials point into it */
+	Chunk *chunk = g_new0(Chunk, 1);
+	gsize  chunk_len;
+	if (volume->partial->len) {
+		g_byte_array_append(volume->partial, (guint8*)data, len);
+		chunk_len   = volume->partial->len;
+		chunk->data = g_byte_array_free(volume->partial, FALSE);
+		volume->partial = g_byte_array_new();
+	} else {
+		chunk_len   = len;
+		chunk->data = g_memdup(data, len);
+	}
+	g_ptr_array_add(volume->chunks, chunk);
+
+	g_mutex_lock(volume->lock);
+	gsize used = _scan_chunk(volume, chunk->data, chunk_len);
+	g_mutex_unlock(volume->lock);
+	g_byte_array_append(volume->partial, chunk->data+used, chunk_len-used);
+	if (chunk->refs == 0) {
+		g_free(chunk->data);
+		chunk->data = NULL;
+	}
+	return !volume->failed;
+}
+
+gboolean wsr88d_volume_finish(Wsr88dVolume *volume)
+{
+	if (volume->partial->len)
+		g_debug("Wsr88dVolume: finish - ignoring %u trailing bytes",
+				volume->partial->len);
+	if (volume->failed || volume->scanning->len == 0) {
+		g_warning("Wsr88dVolume: finish - no radials found");
+		return FALSE;
+	}
+
+	for (guint i = 0; i < volume->scanning->len; i++)
+		_index_sweep(volume, g_ptr_array_index(volume->scanning, i));
+	g_ptr_array_sort(volume->scanning, _sort_sweeps);
+
+	volume->nsweeps = volume->scanning->len;
+	volume->sweeps  = (Wsr88dSweep**)g_ptr_array_free(volume->scanning, FALSE);
+	volume->scanning = NULL;
+	g_byte_array_free(volume->partial, TRUE);
+	volume->partial = NULL;
+	return TRUE;
+}
+
+Wsr88dVolume *wsr88d_volume_scan(Wsr88dVolume *volume)
+{
+	g_mutex_lock(volume->lock);
+	GPtrArray *sweeps = g_ptr_array_new();
+	guint      nfound = volume->scanning ? volume->scanning->len : volume->nsweeps;
+	for (guint i = 0; i < nfound; i++) {
+		Wsr88dSweep *found = volume->scanning ?
+			g_ptr_array_index(volume->scanning, i) : volume->sweeps[i];
+		Wsr88dSweep *sweep = g_memdup(found, sizeof(Wsr88dSweep));
+		sweep->rays    = NULL;
+		sweep->data    = NULL;
+		sweep->radials = NULL;
+		sweep->packed  = NULL;
+		if (found->radials) {
+			gdouble elev = 0;
+			for (guint j = 0; j < found->radials->len; j++)
+				elev += g_array_index(found->radials, Radial, j).elev;
+			sweep->nrays = found->radials->len;
+			sweep->elev  = _sweep_elev(volume, sweep,
+					elev / MAX(found->radials->len, 1));
+		}
+		g_ptr_array_add(sweeps, sweep);
+	}
+	g_ptr_array_sort(sweeps, _sort_sweeps);
+
+	Wsr88dVolume *scan = wsr88d_volume_new();
+	memcpy(scan->site, volume->site, sizeof(scan->site));
+	scan->time     = volume->time;
+	scan->vcp      = volume->vcp;
+	scan->located  = volume->located;
+	scan->lat      = volume->lat;
+	scan->lon      = volume->lon;
+	scan->height   = volume->height;
+	scan->nsweeps  = sweeps->len;
+	scan->sweeps   = (Wsr88dSweep**)g_ptr_array_free(sweeps, FALSE);
+	g_mutex_unlock(volume->lock);
+
+	g_ptr_array_free(scan->scanning, TRUE);
+	g_byte_array_free(scan->partial, TRUE);
+	scan->scanning = NULL;
+	scan->partial  = NULL;
+	return scan;
+}
+
+gboolean wsr88d_volume_load_sweep(Wsr88dVolume *volume, Wsr88dSweep *sweep)
+{
+	g_mutex_lock(volume->lock);
+	if (!sweep->data && sweep->radials)
+		_decode_sweep(sweep);
+	if (!sweep->data && sweep->packed) {
+		gsize size = sweep->nrays * sweep->ngates;
+		sweep->data = g_malloc(size);
+		if (!_cache_unpack(sweep->packed, sweep->packed_len, sweep->data, size)) {
+			g_warning("Wsr88dVolume: load_sweep - bad packed sweep");
+			g_free(sweep->data);
+			sweep->data   = NULL;
+			sweep->packed = NULL;
+		}
+	}
+	g_mutex_unlock(volume->lock);
+	return sweep->data != NULL;
+}
+
+void wsr88d_volume_load_all(Wsr88dVolume *volume)
+{
+	/* The moments of an elevation share chunks, so decode them together.
+	 * Each chunk is freed as soon as its elevation is done, rather than
+	 * once the last moment is reached. */
+	Wsr88dSweep **sweeps = g_memdup(volume->sweeps,
+			volume->nsweeps * sizeof(Wsr88dSweep*));
+	g_qsort_with_data(sweeps, volume->nsweeps, sizeof(Wsr88dSweep*),
+			_sort_recorded, NULL);
+	for (guint i = 0; i < volume->nsweeps; i++)
+		wsr88d_volume_load_sweep(volume, sweeps[i]);
+	g_free(sweeps);
+}
+
+Wsr88dVolume *wsr88d_volume_decode(const gchar *data, gsize len)
+{
+	Wsr88dVolume *volume = wsr88d_volume_new();
+	if (!wsr88d_volume_push(volume, data, len) ||
+	    !wsr88d_volume_finish(volume)) {
+		wsr88d_volume_free(volume);
+		return NULL;
+	}
+	wsr88d_volume_load_all(volume);
+	return volume;
+}
+
+void wsr88d_volume_free(Wsr88dVolume *volume)
+{
+	for (guint i = 0; i < volume->nsweeps; i++) {
+		/* Unpacked gates are the only thing not in the mapping */
+		if (volume->mapped) {
+			volume->sweeps[i]->rays = NULL;
+			if (!volume->sweeps[i]->packed)
+				volume->sweeps[i]->data = NULL;
+		}
+		_free_sweep(volume->sweeps[i]);
+	}
+	if (volume->mapped)
+		g_mapped_file_free(volume->mapped);
+	g_free(volume->sweeps);
+	if (volume->scanning) {
+		g_ptr_array_foreach(volume->scanning, (GFunc)_free_sweep, NULL);
+		g_ptr_array_free(volume->scanning, TRUE);
+	}
+	for (guint i = 0; i < volume->chunks->len; i++) {
+		Chunk *chunk = g_ptr_array_index(volume->chunks, i);
+		g_free(chunk->data);
+		g_free(chunk);
+	}
+	g_ptr_array_free(volume->chunks, TRUE);
+	if (volume->partial)
+		g_byte_array_free(volume->partial, TRUE);
+	g_mutex_free(volume->lock);
+	g_free(volume->cuts);
+	g_free(volume);
+}
+
+Wsr88dSweep *wsr88d_volume_get_sweep(Wsr88dVolume *volume,
+		Wsr88dMoment moment, gfloat elev)
+{
+	Wsr88dSweep *best = NULL;
+	for (guint i = 0; i < volume->nsweeps; i++) {
+		Wsr88dSweep *sweep = volume->sweeps[i];
+		if (sweep->moment != moment)
+			continue;
+		if (!best || fabsf(sweep->elev - elev) < fabsf(best->elev - elev))
+			best = sweep;
+	}
+	return best;
+}
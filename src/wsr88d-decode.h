@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WSR88D_DECODE_H__
+#define __WSR88D_DECODE_H__
+
+#include <time.h>
+#include <glib.h>
+
+/* Decoder for decompressed Level II volumes, Message 31 (Build 10 and
+ * later) and the older Message 1 radials are both supported.
+ *
+ * Each sweep is stored as one contiguous array of 8 bit gate codes with a
+ * separate table of ray headers, rather than one allocation per ray. */
+
+typedef enum {
+	WSR88D_REF,     // Reflectivity             (dBZ)
+	WSR88D_VEL,     // Radial velocity          (m/s)
+	WSR88D_SW,      // Spectrum width           (m/s)
+	WSR88D_ZDR,     // Differential reflectivity (dB)
+	WSR88D_PHI,     // Differential phase       (deg)
+	WSR88D_RHO,     // Correlation coefficient
+	WSR88D_MOMENTS,
+} Wsr88dMoment;
+
+extern const gchar *wsr88d_moment_names[WSR88D_MOMENTS];
+
+/* Gate codes with special meaning, everything above is data */
+#define WSR88D_BELOW_THRESHOLD 0
+#define WSR88D_RANGE_FOLDED    1
+
+typedef struct {
+	gfloat azimuth;           // Degrees clockwise from north
+	gfloat elev;              // Degrees above the horizon
+} Wsr88dRay;
+
+typedef struct {
+	Wsr88dMoment moment;
+	guint        elev_num;    // Elevation number within the volume
+	gfloat       elev;        // Elevation angle from the VCP
+	gfloat       beam_width;  // Azimuth spacing between rays
+	gfloat       range_bin1;  // Range to the center of the first gate (m)
+	gfloat       gate_size;   // Range between gates (m)
+	gfloat       nyquist;     // Nyquist velocity (m/s)
+	gfloat       scale;       //   value = (code - offset) / scale
+	gfloat       offset;
+	guint        nrays;
+	guint        ngates;
+	Wsr88dRay   *rays;        // Ray headers, sorted by azimuth
+	guint8      *data;        // Gate codes, nrays rows of ngates each,
+	                          // NULL until the sweep has been loaded
+
+	/* Private */
+	GArray      *radials;     // Radials found while scanning
+	guint        word_size;
+	const guint8 *packed;     // Gate codes in a cache file, still packed
+	gsize        packed_len;
+} Wsr88dSweep;
+
+typedef struct {
+	gchar         site[5];
+	time_t        time;
+	guint         vcp;
+	gboolean      located;    // Location was included in the volume
+	gfloat        lat;
+	gfloat        lon;
+	gfloat        height;     // Meters above sea level
+	Wsr88dSweep **sweeps;     // Sorted by moment, then elevation
+	guint         nsweeps;
+
+	/* Private */
+	GMutex       *lock;       // Held while loading sweeps
+	GPtrArray    *chunks;     // Decompressed data the radials point into
+	GByteArray   *partial;    // Start of a message split between pushes
+	GPtrArray    *scanning;   // Sweeps found so far
+	gfloat       *cuts;       // Elevation angles from the VCP message
+	guint         ncuts;
+	GMappedFile  *mapped;     // Cache file the sweeps point into
+	gboolean      header;
+	gboolean      failed;
+} Wsr88dVolume;
+
+Wsr88dVolume *wsr88d_volume_new(void);
+
+/* Add decompressed data, starting with the 24 byte volume header. The data
+ * is copied and can be split anywhere, such as one push per record. */
+gboolean wsr88d_volume_push(Wsr88dVolume *volume, const gchar *data, gsize len);
+
+/* Build the sweep table once all the data has been pushed. Everything
+ * except the gate data is filled in, the gates for each sweep are only
+ * decoded once it is loaded. */
+gboolean wsr88d_volume_finish(Wsr88dVolume *volume);
+
+/* Quick look at the data pushed so far, without decoding any gates. This
+ * can be called while another thread is still pushing data, the result is a
+ * separate volume with the site, time, VCP and a sweep for each moment and
+ * elevation found so far. The sweeps have nrays set to the number of rays
+ * seen, but no rays or data, and can not be loaded. */
+Wsr88dVolume *wsr88d_volume_scan(Wsr88dVolume *volume);
+
+/* Decode the gates for a sweep if they have not been already. This can be
+ * called from any thread, the decompressed data is freed as soon as all
+ * the sweeps using it have been loaded. */
+gboolean wsr88d_volume_load_sweep(Wsr88dVolume *volume, Wsr88dSweep *sweep);
+
+void wsr88d_volume_load_all(Wsr88dVolume *volume);
+
+/* Decode a complete decompressed volume and load every sweep */
+Wsr88dVolume *wsr88d_volume_decode(const gchar *data, gsize len);
+
+/* Cache of decoded volumes. The file has a fixed header and a table of
+ * sweep headers followed by the rays and gate codes for each sweep, in host
+ * byte order. Saving loads every sweep first and replaces `file' atomically,
+ * mapping the file points the sweeps straight at the mapped data.
+ *
+ * The gate codes for each sweep are run length encoded when that makes them
+ * smaller, those sweeps are unpacked when they're loaded. */
+gboolean wsr88d_volume_save(Wsr88dVolume *volume, const gchar *file);
+
+Wsr88dVolume *wsr88d_volume_map(const gchar *file);
+
+void wsr88d_volume_free(Wsr88dVolume *volume);
+
+/* Find the sweep of the given moment closest to `elev' */
+Wsr88dSweep *wsr88d_volume_get_sweep(Wsr88dVolume *volume,
+		Wsr88dMoment moment, gfloat elev);
+
+static inline gfloat wsr88d_sweep_value(Wsr88dSweep *sweep, guint8 code)
+{
+	return (code - sweep->offset) / sweep->scale;
+}
+
+#endif
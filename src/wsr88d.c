@@ -0,0 +1,525 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <bzlib.h>
+
+#include "wsr88d.h"
+
+#define SANITY_MAX_SIZE 50*1024*1024 // 50 MB/bzip
+
+/* Radial records hold 120 messages, 2432 bytes each for Message 1 and up
+ * to ~16 KB each for super-res dual-pol Message 31. The metadata record
+ * is always 134*2432 bytes. 2 MB covers all of these without resizing. */
+#define ARENA_SIZE 2*1024*1024
+
+/* Output buffer which is reused between records */
+typedef struct {
+	gchar *data;
+	gsize  size;
+	gsize  len;
+	Wsr88dResizeFunc resize; // g_realloc if NULL
+	gpointer         user_data;
+} Arena;
+
+/* A single size-prefixed bzip2 record from the input */
+typedef struct {
+	const gchar *input;
+	gsize        input_len;
+	Arena       *output;     // Held until the record is passed on
+	gboolean     ok;
+	gboolean     done;
+} Record;
+
+/* State shared between the worker pool and the writer */
+typedef struct {
+	GMutex *lock;
+	GCond  *cond;
+	GSList *arenas;  // Idle arenas, one per running worker
+} Jobs;
+
+static Wsr88dStats  stats;
+static GStaticMutex stats_lock = G_STATIC_MUTEX_INIT;
+
+static void _stats_add(guint records, guint allocs, gsize copied, gsize output)
+{
+	g_static_mutex_lock(&stats_lock);
+	stats.records += records;
+	stats.allocs  += allocs;
+	stats.copied  += copied;
+	stats.output  += output;
+	g_static_mutex_unlock(&stats_lock);
+}
+
+/* Make sure there's room for `size' bytes in total */
+static void _arena_reserve(Arena *arena, gsize size)
+{
+	if (arena->size >= size)
+		return;
+	arena->size = MAX(size, arena->size*2);
+	arena->data = arena->resize ?
+		arena->resize(arena->data, arena->size, arena->user_data) :
+		g_realloc(arena->data, arena->size);
+	_stats_add(0, 1, arena->resize ? 0 : arena->len, 0);
+}
+
+/* Decompress a single bzip2 record onto the end of the arena */
+static gboolean _bunzip2(const gchar *input, gsize input_len, Arena *arena)
+{
+	bz_stream stream = {};
+
+	switch (BZ2_bzDecompressInit(&stream, 0, 0)) {
+	case BZ_CONFIG_ERROR: g_error("the library has been mis-compiled");
+	case BZ_PARAM_ERROR:  g_error("Parameter error");
+	case BZ_MEM_ERROR:    g_error("insufficient memory is available");
+	//case BZ_OK:           g_debug("success"); break;
+	//default:              g_debug("unknown"); break;
+	}
+
+	/* The stream is never restarted, when the arena fills up
+	 * it is resized and decompression continues at the end */
+	int   status;
+	gsize start = arena->len;
+	stream.next_in  = (gchar*)input;
+	stream.avail_in = input_len;
+	do {
+		if (arena->len == arena->size)
+			_arena_reserve(arena, arena->size + ARENA_SIZE);
+		stream.next_out  = arena->data + arena->len;
+		stream.avail_out = arena->size - arena->len;
+		status = BZ2_bzDecompress(&stream);
+		arena->len = stream.next_out - arena->data;
+	} while (status == BZ_OK && stream.avail_out == 0 &&
+	         arena->len - start < SANITY_MAX_SIZE);
+
+	//g_debug("done with status %d = %d", status, BZ_STREAM_END);
+
+	BZ2_bzDecompressEnd(&stream);
+	_stats_add(1, 0, 0, arena->len - start);
+	if (status != BZ_STREAM_END) {
+		g_warning("wsr88d: bunzip2 - error %d decompressing record", status);
+		arena->len = start;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gint _get_threads(gint threads)
+{
+	if (threads > 0)
+		return threads;
+#ifdef _SC_NPROCESSORS_ONLN
+	return MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+#else
+	return 1;
+#endif
+}
+
+/* Find the offsets of all the bzip records, skipping the volume header */
+static GArray *_scan_records(const gchar *input, gsize input_len)
+{
+	GArray *records = g_array_new(FALSE, TRUE, sizeof(Record));
+	gsize offset = WSR88D_HEADER_SIZE;
+	while (offset + 4 <= input_len) {
+		gint32 size;
+		memcpy(&size, input+offset, 4);
+		size = ABS((gint32)g_ntohl(size));
+		if (size < 0)
+			break;
+		if (size > SANITY_MAX_SIZE || offset + 4 + size > input_len) {
+			g_warning("wsr88d: scan_records - bad record size %d at %lu",
+					size, (gulong)offset);
+			g_array_free(records, TRUE);
+			return NULL;
+		}
+		Record record = {};
+		record.input     = input + offset + 4;
+		record.input_len = size;
+		g_array_append_val(records, record);
+		offset += 4 + size;
+	}
+	return records;
+}
+
+/* Give an arena back once the writer is done with its record */
+static void _arena_release(Jobs *jobs, Arena *arena)
+{
+	if (!arena)
+		return;
+	g_mutex_lock(jobs->lock);
+	jobs->arenas = g_slist_prepend(jobs->arenas, arena);
+	g_mutex_unlock(jobs->lock);
+}
+
+static void _arenas_free(Jobs *jobs)
+{
+	for (GSList *cur = jobs->arenas; cur; cur = cur->next) {
+		Arena *arena = cur->data;
+		g_free(arena->data);
+		g_free(arena);
+	}
+	g_slist_free(jobs->arenas);
+}
+
+/* Worker thread, decompress a single record and notify the writer. The
+ * record keeps the arena until the writer has passed it on, so the data
+ * is never copied out of it. */
+static void _decompress_record(gpointer _record, gpointer _jobs)
+{
+	Record *record = _record;
+	Jobs   *jobs   = _jobs;
+
+	/* Grab an idle arena */
+	Arena *arena = NULL;
+	g_mutex_lock(jobs->lock);
+	if (jobs->arenas) {
+		arena        = jobs->arenas->data;
+		jobs->arenas = g_slist_delete_link(jobs->arenas, jobs->arenas);
+	}
+	g_mutex_unlock(jobs->lock);
+	if (!arena) {
+		arena = g_new0(Arena, 1);
+		_arena_reserve(arena, ARENA_SIZE);
+	}
+
+	arena->len = 0;
+	gboolean ok = _bunzip2(record->input, record->input_len, arena);
+
+	g_mutex_lock(jobs->lock);
+	record->output = arena;
+	record->ok     = ok;
+	record->done   = TRUE;
+	g_cond_broadcast(jobs->cond);
+	g_mutex_unlock(jobs->lock);
+}
+
+/* Decompress in the calling thread. With a callback each record is passed
+ * straight out of the arena, otherwise the records are left in the arena
+ * one after the other. */
+static gboolean _decompress_serial(GArray *records, Arena *arena,
+		Wsr88dFunc func, gpointer user_data)
+{
+	for (guint i = 0; i < records->len; i++) {
+		Record *record = &g_array_index(records, Record, i);
+		if (func)
+			arena->len = 0;
+		if (!_bunzip2(record->input, record->input_len, arena))
+			return FALSE;
+		if (func && !func(arena->data, arena->len, user_data))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Decompress on a thread pool, records are taken in order */
+static gboolean _decompress_parallel(GArray *records, gint threads,
+		Wsr88dFunc func, gpointer user_data)
+{
+	gboolean ok = TRUE;
+	Jobs jobs = { g_mutex_new(), g_cond_new(), NULL };
+	GThreadPool *pool = g_thread_pool_new(_decompress_record, &jobs,
+			threads, TRUE, NULL);
+	for (guint i = 0; i < records->len; i++)
+		g_thread_pool_push(pool, &g_array_index(records, Record, i), NULL);
+
+	for (guint i = 0; ok && i < records->len; i++) {
+		Record *record = &g_array_index(records, Record, i);
+		g_mutex_lock(jobs.lock);
+		while (!record->done)
+			g_cond_wait(jobs.cond, jobs.lock);
+		g_mutex_unlock(jobs.lock);
+		ok = record->ok && func(record->output->data,
+				record->output->len, user_data);
+		_arena_release(&jobs, record->output);
+		record->output = NULL;
+	}
+
+	/* Drop anything still queued if we stopped early */
+	g_thread_pool_free(pool, !ok, TRUE);
+	for (guint i = 0; i < records->len; i++)
+		_arena_release(&jobs, g_array_index(records, Record, i).output);
+	_arenas_free(&jobs);
+	g_mutex_free(jobs.lock);
+	g_cond_free(jobs.cond);
+	return ok;
+}
+
+gboolean wsr88d_decompress_cb(const gchar *input, gsize input_len, gint threads,
+		Wsr88dFunc func, gpointer user_data)
+{
+	if (input_len < WSR88D_HEADER_SIZE) {
+		g_warning("wsr88d: decompress - missing header");
+		return FALSE;
+	}
+	if (!func(input, WSR88D_HEADER_SIZE, user_data))
+		return FALSE;
+
+	GArray *records = _scan_records(input, input_len);
+	if (!records)
+		return FALSE;
+	threads = MIN(_get_threads(threads), records->len);
+
+	gboolean ok;
+	if (threads <= 1) {
+		Arena arena = {};
+		_arena_reserve(&arena, ARENA_SIZE);
+		ok = _decompress_serial(records, &arena, func, user_data);
+		g_free(arena.data);
+	} else {
+		ok = _decompress_parallel(records, threads, func, user_data);
+	}
+	g_array_free(records, TRUE);
+	return ok;
+}
+
+/* Streaming decompression */
+struct _Wsr88dStream {
+	Jobs         jobs;
+	GThreadPool *pool;
+	Wsr88dFunc   func;
+	gpointer     user_data;
+	GByteArray  *pending;    // Input that isn't a complete record yet
+	gboolean     header;     // Volume header has been passed on
+	GPtrArray   *records;    // Every record pushed so far
+	guint        next;       // Next record to pass on
+	gboolean     delivering; // A worker is passing records on
+	gboolean     failed;
+};
+
+static void _stream_record(gpointer _record, gpointer _stream)
+{
+	Wsr88dStream *stream = _stream;
+	_decompress_record(_record, &stream->jobs);
+
+	/* Pass on finished records in order, one thread at a time */
+	g_mutex_lock(stream->jobs.lock);
+	if (stream->delivering) {
+		g_mutex_unlock(stream->jobs.lock);
+		return;
+	}
+	stream->delivering = TRUE;
+	while (stream->next < stream->records->len) {
+		Record *record = g_ptr_array_index(stream->records, stream->next);
+		if (!record->done)
+			break;
+		gboolean ok = !stream->failed;
+		g_mutex_unlock(stream->jobs.lock);
+		if (ok)
+			ok = record->ok && stream->func(record->output->data,
+					record->output->len, stream->user_data);
+		_arena_release(&stream->jobs, record->output);
+		record->output = NULL;
+		g_mutex_lock(stream->jobs.lock);
+		if (!ok)
+			stream->failed = TRUE;
+		stream->next++;
+	}
+	stream->delivering = FALSE;
+	g_mutex_unlock(stream->jobs.lock);
+}
+
+Wsr88dStream *wsr88d_stream_new(gint threads, Wsr88dFunc func, gpointer user_data)
+{
+	Wsr88dStream *stream = g_new0(Wsr88dStream, 1);
+	stream->jobs.lock = g_mutex_new();
+	stream->jobs.cond = g_cond_new();
+	stream->func      = func;
+	stream->user_data = user_data;
+	stream->pending   = g_byte_array_new();
+	stream->records   = g_ptr_array_new();
+	stream->pool      = g_thread_pool_new(_stream_record, stream,
+			_get_threads(threads), FALSE, NULL);
+	return stream;
+}
+
+gboolean wsr88d_stream_push(Wsr88dStream *stream, const gchar *data, gsize len)
+{
+	GByteArray *pending = stream->pending;
+	g_byte_array_append(pending, (const guint8*)data, len);
+
+	/* Header, no records are queued yet so call func directly */
+	if (!stream->header) {
+		if (pending->len < WSR88D_HEADER_SIZE)
+			return TRUE;
+		if (!stream->func((gchar*)pending->data, WSR88D_HEADER_SIZE,
+					stream->user_data))
+			stream->failed = TRUE;
+		g_byte_array_remove_range(pending, 0, WSR88D_HEADER_SIZE);
+		stream->header = TRUE;
+	}
+
+	/* Queue each complete record */
+	while (pending->len >= 4) {
+		gint32 size;
+		memcpy(&size, pending->data, 4);
+		size = ABS((gint32)g_ntohl(size));
+		if (size < 0 || size > SANITY_MAX_SIZE) {
+			g_warning("wsr88d: stream_push - bad record size %d", size);
+			g_mutex_lock(stream->jobs.lock);
+			stream->failed = TRUE;
+			g_mutex_unlock(stream->jobs.lock);
+			break;
+		}
+		if (pending->len < 4 + size)
+			break;
+		Record *record = g_new0(Record, 1);
+		record->input     = g_memdup(pending->data + 4, size);
+		record->input_len = size;
+		g_byte_array_remove_range(pending, 0, 4 + size);
+		g_mutex_lock(stream->jobs.lock);
+		g_ptr_array_add(stream->records, record);
+		g_mutex_unlock(stream->jobs.lock);
+		g_thread_pool_push(stream->pool, record, NULL);
+	}
+
+	g_mutex_lock(stream->jobs.lock);
+	gboolean ok = !stream->failed;
+	g_mutex_unlock(stream->jobs.lock);
+	return ok;
+}
+
+gboolean wsr88d_stream_finish(Wsr88dStream *stream)
+{
+	/* Every job passes on what it can, so once the pool
+	 * is empty all the records have been handled */
+	g_thread_pool_free(stream->pool, FALSE, TRUE);
+
+	gboolean ok = !stream->failed && stream->header &&
+		stream->pending->len == 0 && stream->next == stream->records->len;
+	if (stream->pending->len)
+		g_warning("wsr88d: stream_finish - truncated record");
+
+	for (guint i = 0; i < stream->records->len; i++) {
+		Record *record = g_ptr_array_index(stream->records, i);
+		_arena_release(&stream->jobs, record->output);
+		g_free((gchar*)record->input);
+		g_free(record);
+	}
+	_arenas_free(&stream->jobs);
+	g_ptr_array_free(stream->records, TRUE);
+	g_byte_array_free(stream->pending, TRUE);
+	g_mutex_free(stream->jobs.lock);
+	g_cond_free(stream->jobs.cond);
+	g_free(stream);
+	return ok;
+}
+
+static gboolean _append_cb(const gchar *data, gsize len, gpointer _arena)
+{
+	Arena *arena = _arena;
+	_arena_reserve(arena, arena->len + len);
+	memcpy(arena->data + arena->len, data, len);
+	arena->len += len;
+	_stats_add(0, 0, len, 0);
+	return TRUE;
+}
+
+gboolean wsr88d_decompress_into(const gchar *input, gsize input_len, gint threads,
+		Wsr88dResizeFunc resize, gpointer user_data,
+		gchar **output, gsize *output_len)
+{
+	/* Volumes are usually about 10x the size of the bzip2 file */
+	Arena arena = { .resize = resize, .user_data = user_data };
+	_arena_reserve(&arena, input_len*10);
+
+	/* A single thread decompresses directly onto the end of the output.
+	 * Workers can't, the offset of a record isn't known until the ones
+	 * before it are done, so each record is copied once from its arena. */
+	gboolean ok;
+	GArray *records = _scan_records(input, input_len);
+	if (!records || input_len < WSR88D_HEADER_SIZE) {
+		ok = FALSE;
+	} else if ((threads = MIN(_get_threads(threads), records->len)) <= 1) {
+		_append_cb(input, WSR88D_HEADER_SIZE, &arena);
+		ok = _decompress_serial(records, &arena, NULL, NULL);
+	} else {
+		_append_cb(input, WSR88D_HEADER_SIZE, &arena);
+		ok = _decompress_parallel(records, threads, _append_cb, &arena);
+	}
+	if (records)
+		g_array_free(records, TRUE);
+
+	*output     = arena.data;
+	*output_len = arena.len;
+	return ok;
+}
+
+gchar *wsr88d_decompress(const gchar *input, gsize input_len, gint threads,
+		gsize *output_len)
+{
+	gchar *output;
+	if (!wsr88d_decompress_into(input, input_len, threads,
+				NULL, NULL, &output, output_len)) {
+		g_free(output);
+		return NULL;
+	}
+	return output;
+}
+
+void wsr88d_get_stats(Wsr88dStats *out)
+{
+	g_static_mutex_lock(&stats_lock);
+	*out = stats;
+	g_static_mutex_unlock(&stats_lock);
+}
+
+void wsr88d_reset_stats(void)
+{
+	g_static_mutex_lock(&stats_lock);
+	memset(&stats, 0, sizeof(stats));
+	g_static_mutex_unlock(&stats_lock);
+}
+
+gchar *wsr88d_decompress_fd(int fd, gint threads, gsize *output_len)
+{
+	gsize  len  = 0;
+	gsize  size = 1024*1024;
+	gchar *buf  = g_malloc(size);
+	gssize st;
+	while ((st = read(fd, buf+len, size-len)) != 0) {
+		if (st < 0) {
+			g_warning("wsr88d: decompress_fd - error reading input");
+			g_free(buf);
+			return NULL;
+		}
+		len += st;
+		if (len == size)
+			buf = g_realloc(buf, size *= 2);
+	}
+	gchar *output = wsr88d_decompress(buf, len, threads, output_len);
+	g_free(buf);
+	return output;
+}
+
+gchar *wsr88d_decompress_file(const gchar *file, gint threads, gsize *output_len)
+{
+	GError      *error  = NULL;
+	GMappedFile *mapped = g_mapped_file_new(file, FALSE, &error);
+	if (!mapped) {
+		g_warning("wsr88d: decompress_file - %s", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+	gchar *output = wsr88d_decompress(
+			g_mapped_file_get_contents(mapped),
+			g_mapped_file_get_length(mapped),
+			threads, output_len);
+	g_mapped_file_free(mapped);
+	return output;
+}
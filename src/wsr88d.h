@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WSR88D_H__
+#define __WSR88D_H__
+
+#include <glib.h>
+
+/* Size of the uncompressed volume header at the start of every file */
+#define WSR88D_HEADER_SIZE 24
+
+/* Called with each piece of the decompressed volume, in file order. The
+ * first call is always the 24 byte volume header. Return FALSE to stop. */
+typedef gboolean (*Wsr88dFunc)(const gchar *data, gsize len, gpointer user_data);
+
+/* Decompress a Level II volume using up to `threads' worker threads,
+ * a value of 0 uses one thread per processor. */
+gboolean wsr88d_decompress_cb(const gchar *input, gsize input_len, gint threads,
+		Wsr88dFunc func, gpointer user_data);
+
+gchar *wsr88d_decompress(const gchar *input, gsize input_len, gint threads,
+		gsize *output_len);
+
+/* Resize the output buffer to `size' bytes, and return the new location */
+typedef gchar *(*Wsr88dResizeFunc)(gchar *data, gsize size, gpointer user_data);
+
+/* Decompress into a buffer which is grown with `resize', such as a memory
+ * mapped file. The buffer is returned even on failure so it can be freed. */
+gboolean wsr88d_decompress_into(const gchar *input, gsize input_len, gint threads,
+		Wsr88dResizeFunc resize, gpointer user_data,
+		gchar **output, gsize *output_len);
+
+gchar *wsr88d_decompress_fd(int fd, gint threads, gsize *output_len);
+
+gchar *wsr88d_decompress_file(const gchar *file, gint threads, gsize *output_len);
+
+/* Decompress a volume as it arrives, e.g. while it is being downloaded.
+ * Records are decompressed in worker threads as soon as they are complete
+ * and `func' is called in order from whichever worker finishes them. */
+typedef struct _Wsr88dStream Wsr88dStream;
+
+Wsr88dStream *wsr88d_stream_new(gint threads, Wsr88dFunc func, gpointer user_data);
+
+gboolean wsr88d_stream_push(Wsr88dStream *stream, const gchar *data, gsize len);
+
+/* Wait for all queued records and free the stream, returns FALSE if
+ * anything failed or the input ended in the middle of a record */
+gboolean wsr88d_stream_finish(Wsr88dStream *stream);
+
+/* Running totals for every volume decompressed by this process */
+typedef struct {
+	guint records; // bzip2 records decompressed
+	guint allocs;  // output buffers allocated or resized
+	gsize copied;  // bytes moved between buffers after decompression
+	gsize output;  // bytes decompressed
+} Wsr88dStats;
+
+void wsr88d_get_stats(Wsr88dStats *stats);
+
+void wsr88d_reset_stats(void);
+
+#endif
@@ -15,100 +15,167 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib.h>
-#include <bzlib.h>
+#ifndef G_OS_WIN32
+#include <sys/mman.h>
+#endif
 
-#define SANITY_MAX_SIZE 50*1024*1024 // 50 MB/bzip
+#include "wsr88d.h"
 
-char *bunzip2(char *input, int input_len, int *output_len)
+/* Read the entire input when it can't be mapped, e.g. for pipes */
+gchar *read_input(FILE *input, gsize *input_len)
 {
-	bz_stream *stream = g_new0(bz_stream, 1);
-
-	switch (BZ2_bzDecompressInit(stream, 0, 0)) {
-	case BZ_CONFIG_ERROR: g_error("the library has been mis-compiled");
-	case BZ_PARAM_ERROR:  g_error("Parameter error");
-	case BZ_MEM_ERROR:    g_error("insufficient memory is available");
-	//case BZ_OK:           g_debug("success"); break;
-	//default:              g_debug("unknown"); break;
+	gsize  len  = 0;
+	gsize  size = 1024*1024;
+	gchar *buf  = g_malloc(size);
+	gsize  st;
+	while ((st = fread(buf+len, 1, size-len, input)) > 0) {
+		len += st;
+		if (len == size)
+			buf = g_realloc(buf, size *= 2);
 	}
+	if (ferror(input))
+		g_error("error reading input");
+	*input_len = len;
+	return buf;
+}
+
+/* Write each decompressed record straight to the output file */
+typedef struct {
+	FILE *fp;
+	gsize len;
+} Output;
 
-	int   status;
-	int   output_size = 512;
-	char *output      = NULL;
-
-	do {
-		stream->next_in   = input       + stream->total_in_lo32;
-		stream->avail_in  = input_len   - stream->total_in_lo32;
-		output_size *= 2;
-		output       = g_realloc(output, output_size);
-		//g_debug("alloc %d", output_size);
-		stream->next_out  = output      + stream->total_out_lo32;
-		stream->avail_out = output_size - stream->total_out_lo32;
-		//g_debug("decompressing..\n"
-		//      "  next_in   = %p\n"
-		//      "  avail_in  = %u\n"
-		//      "  next_out  = %p\n"
-		//      "  avail_out = %u",
-		//      stream->next_in,
-		//      stream->avail_in,
-		//      stream->next_out,
-		//      stream->avail_out);
-	} while ((status = BZ2_bzDecompress(stream)) == BZ_OK && output_size < SANITY_MAX_SIZE);
-
-	//g_debug("done with status %d = %d", status, BZ_STREAM_END);
-
-	*output_len = stream->total_out_lo32;
-	BZ2_bzDecompressEnd(stream);
-	return output;
+gboolean write_cb(const gchar *data, gsize len, gpointer _output)
+{
+	Output *output = _output;
+	if (fwrite(data, 1, len, output->fp) != len)
+		g_error("error writing data");
+	output->len += len;
+	return TRUE;
 }
 
+#ifndef G_OS_WIN32
+/* Grow the output file and map it again */
+typedef struct {
+	int   fd;
+	gsize size;
+} Mapping;
+
+gchar *remap_cb(gchar *data, gsize size, gpointer _map)
+{
+	Mapping *map = _map;
+	if (data)
+		munmap(data, map->size);
+	if (ftruncate(map->fd, size) != 0)
+		g_error("error resizing output");
+	data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, map->fd, 0);
+	if (data == MAP_FAILED)
+		g_error("error mapping output");
+	map->size = size;
+	return data;
+}
+
+/* Decompress records directly into the mapped output file */
+gsize decompress_mapped(const gchar *input, gsize len, gint threads, int fd)
+{
+	gchar  *output;
+	gsize   output_len;
+	Mapping map = { fd, 0 };
+	if (!wsr88d_decompress_into(input, len, threads, remap_cb, &map,
+				&output, &output_len))
+		g_error("error decompressing data");
+	munmap(output, map.size);
+	if (ftruncate(fd, output_len) != 0)
+		g_error("error resizing output");
+	return output_len;
+}
+#endif
+
 int main(int argc, char **argv)
 {
+	gint     threads = 1;
+	gboolean verbose = FALSE;
+	GOptionEntry entries[] = {
+		//long      short flg type              location  description                          arg desc
+		{"jobs",    'j',  0,  G_OPTION_ARG_INT,  &threads, "Decompress using N threads",        "N"},
+		{"verbose", 'v',  0,  G_OPTION_ARG_NONE, &verbose, "Print decompression throughput",    NULL},
+		{NULL}
+	};
+
+	GError *error = NULL;
+	GOptionContext *context = g_option_context_new("<input> <output>");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_print("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
 	if (argc != 3) {
-		g_print("usage: %s <input> <output>\n", argv[0]);
+		g_print("usage: %s [-j N] [-v] <input> <output>\n", argv[0]);
 		return 0;
 	}
 
-	FILE *input  = fopen(argv[1], "rb");
-	FILE *output = fopen(argv[2], "wb+");
-	if (!input)  g_error("error opening input");
+	g_thread_init(NULL);
+	GTimer *timer = g_timer_new();
+
+	/* Map the input if possible, otherwise read it all */
+	gsize        len;
+	gchar       *input;
+	GMappedFile *mapped = NULL;
+	if (strcmp(argv[1], "-") != 0 &&
+	    (mapped = g_mapped_file_new(argv[1], FALSE, NULL))) {
+		input = g_mapped_file_get_contents(mapped);
+		len   = g_mapped_file_get_length(mapped);
+	} else {
+		FILE *fp = strcmp(argv[1], "-") ? fopen(argv[1], "rb") : stdin;
+		if (!fp) g_error("error opening input");
+		input = read_input(fp, &len);
+		fclose(fp);
+	}
+
+	/* Map the output if it's a regular file, otherwise use stdio */
+	gsize total;
+	FILE *output = strcmp(argv[2], "-") ? fopen(argv[2], "wb+") : stdout;
 	if (!output) g_error("error opening output");
+#ifndef G_OS_WIN32
+	struct stat st;
+	if (fstat(fileno(output), &st) == 0 && S_ISREG(st.st_mode)) {
+		total = decompress_mapped(input, len, MAX(threads, 1), fileno(output));
+	} else
+#endif
+	{
+		Output stream = { output, 0 };
+		if (!wsr88d_decompress_cb(input, len, MAX(threads, 1), write_cb, &stream))
+			g_error("error decompressing data");
+		total = stream.len;
+	}
+	if (fclose(output) != 0)
+		g_error("error writing output");
+	if (mapped)
+		g_mapped_file_free(mapped);
+	else
+		g_free(input);
 
-	int st;
-	int size = 0;
-	char *buf = g_malloc(24);
-
-	/* Clear header */
-	//g_debug("reading header");
-	if (!fread (buf, 24, 1, input))
-		g_error("error reading header");
-	if (!fwrite(buf, 24, 1, output))
-		g_error("error writing header");
-
-	//g_debug("reading body");
-	while ((st = fread(&size, 1, 4, input))) {
-		//g_debug("size=%08x", size);
-		//g_debug("read %u bytes", st);
-		//fwrite(&size, 1, 4, output); // DEBUG
-		size = ABS(g_ntohl(size));
-		if (size < 0)
-			return 0;
-		//g_debug("size = %x", size);
-		if (size > SANITY_MAX_SIZE)
-			g_error("sanity check failed, buf is to big: %d", size);
-		buf = g_realloc(buf, size);
-		if (fread(buf, 1, size, input) != size)
-			g_error("error reading data");
-		//fwrite(buf, 1, size, output); // DEBUG
-
-		int dec_len;
-		char *dec = bunzip2(buf, size, &dec_len);
-		//g_debug("decompressed %u bytes", dec_len);
-		if (fwrite(dec, 1, dec_len, output) != dec_len)
-			g_error("error writing data");
-		g_free(dec);
-		//g_debug("decompressed %-6x -> %x", size, dec_len);
+	gdouble elapsed = g_timer_elapsed(timer, NULL);
+	if (verbose) {
+		Wsr88dStats stats;
+		wsr88d_get_stats(&stats);
+		g_printerr("%s: %.2f MB in %.3f s (%.2f MB/s, %d threads)\n",
+				argv[1], (double)total/1000000, elapsed,
+				(double)total/1000000/MAX(elapsed, 1e-6), MAX(threads, 1));
+		g_printerr("%s: %u records, %u allocations, %.2f MB copied\n",
+				argv[1], stats.records, stats.allocs,
+				(double)stats.copied/1000000);
 	}
+	g_timer_destroy(timer);
 
 	return 0;
 }